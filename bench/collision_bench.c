@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "../include/collision.h"
+#include "../include/broadphase.h"
+#include "../include/vector.h"
+
+// Headless collision benchmarks, build with `make bench`. Same line format as ecs_bench.
+// Linked with --wrap for malloc/calloc/realloc so heap use inside a measured section shows up.
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+static size_t allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static ColliderInfo new_rect(float width, float height) {
+    Vector2 vertices[4] = {{0,0}, {width,0}, {width,height}, {0,height}};
+    return collider_info_vertices(vertices, 4);
+}
+
+static ColliderInfo new_box(float width, float height) {
+    ColliderInfo info = {0};
+    info.collider_t = COLLIDER_BOX;
+    info.box_info.size = (Vector2){width,height};
+    return info;
+}
+
+static ColliderInfo new_circle(float radius) {
+    ColliderInfo info = {0};
+    info.collider_t = COLLIDER_CIRCLE;
+    info.circle_info.radius = radius;
+    return info;
+}
+
+// Overlapping pairs at random offsets, GJK runs outside the measured section
+void bench_epa(const char *name, ColliderInfo a, ColliderInfo b, size_t calls) {
+    Vector2 (*simplices)[3] = malloc(sizeof(Vector2[3])*calls);
+    Vector2 *offsets = malloc(sizeof(Vector2)*calls);
+    srand(1);
+    for(size_t ind=0;ind<calls;) {
+        Vector2 offset = {rand()%100/10.f, rand()%100/10.f};
+        Vector2 dir = {0};
+        if(!gjk_intersect((Vector2){0,0}, &a, offset, &b, &dir, simplices[ind])) continue;
+        offsets[ind++] = offset;
+    }
+
+    float checksum = 0.f;
+    size_t allocations_before = allocations;
+    double start = now_ns();
+    for(size_t ind=0;ind<calls;ind++) {
+        Penetration penetration = epa_penetration((Vector2){0,0}, &a, offsets[ind], &b, simplices[ind]);
+        checksum += penetration.depth;
+    }
+    double elapsed = now_ns() - start;
+    size_t call_allocations = allocations - allocations_before;
+    printf("epa pair=%s calls=%zu ns_per_call=%.1f allocations_per_call=%.3f checksum=%.1f\n", name, calls, elapsed/calls, (double)call_allocations/calls, checksum);
+
+    free(simplices);
+    free(offsets);
+}
+
+// Random offsets around a, a bit under half of them overlapping
+void bench_narrowphase(const char *name, ColliderInfo a, ColliderInfo b, size_t calls) {
+    Vector2 *offsets = malloc(sizeof(Vector2)*calls);
+    srand(1);
+    for(size_t ind=0;ind<calls;ind++) {
+        offsets[ind] = (Vector2){rand()%300/10.f-15.f, rand()%300/10.f-15.f};
+    }
+
+    size_t hits = 0;
+    Vector2 dir = {0};
+    Vector2 simplex[3];
+    Penetration penetration;
+    size_t allocations_before = allocations;
+    double start = now_ns();
+    for(size_t ind=0;ind<calls;ind++) {
+        hits += narrowphase_collide((Vector2){0,0}, &a, offsets[ind], &b, &dir, simplex, &penetration);
+    }
+    double elapsed = now_ns() - start;
+    size_t call_allocations = allocations - allocations_before;
+    printf("narrowphase pair=%s calls=%zu hits=%zu ns_per_call=%.1f allocations_per_call=%.3f\n", name, calls, hits, elapsed/calls, (double)call_allocations/calls);
+
+    free(offsets);
+}
+
+// Regular hull of n vertices, AoS scalar loop against the SoA kernel the vertex pool feeds
+void bench_support(uint32_t n_of_vertices, size_t calls) {
+    Vector2 vertices[32];
+    for(uint32_t ind=0;ind<n_of_vertices;ind++) {
+        float angle = 2*PI*ind/n_of_vertices;
+        vertices[ind] = (Vector2){cosf(angle)*10, sinf(angle)*10};
+    }
+    ColliderInfo info = collider_info_vertices(vertices, n_of_vertices);
+    float padded_xs[32], padded_ys[32];
+    for(uint32_t ind=0;ind<32;ind++) {
+        Vector2 vertex = vertices[ind < n_of_vertices ? ind : n_of_vertices-1];
+        padded_xs[ind] = vertex.x;
+        padded_ys[ind] = vertex.y;
+    }
+
+    Vector2 *dirs = malloc(sizeof(Vector2)*calls);
+    srand(1);
+    for(size_t ind=0;ind<calls;ind++) {
+        float angle = rand()%3600/1800.f*PI;
+        dirs[ind] = (Vector2){cosf(angle), sinf(angle)};
+    }
+
+    float checksum = 0.f;
+    double start = now_ns();
+    for(size_t ind=0;ind<calls;ind++) {
+        checksum += support_function_vertices((Vector2){0,0}, vertices, n_of_vertices, dirs[ind]).x;
+    }
+    double scalar = now_ns() - start;
+
+    start = now_ns();
+    for(size_t ind=0;ind<calls;ind++) {
+        checksum -= support_function_vertices_soa((Vector2){0,0}, padded_xs, padded_ys, n_of_vertices, dirs[ind]).x;
+    }
+    double simd = now_ns() - start;
+
+    start = now_ns();
+    for(size_t ind=0;ind<calls;ind++) {
+        checksum += support_function((Vector2){0,0}, &info, dirs[ind]).x;
+    }
+    double pooled = now_ns() - start;
+    printf("support vertices=%u calls=%zu simd_width=%zu scalar_ns=%.2f soa_ns=%.2f pooled_ns=%.2f checksum=%.1f\n", n_of_vertices, calls, support_simd_width(), scalar/calls, simd/calls, pooled/calls, checksum);
+
+    free(dirs);
+}
+
+static AABB collider_aabb(const ColliderInfo *info, Vector2 position) {
+    AABB aabb;
+    switch(info->collider_t) {
+        case COLLIDER_VERTICES: {
+            const Vector2 *vertices = vertex_pool_vertices(info->vertices_info.offset);
+            aabb.min = aabb.max = vertices[0];
+            for(uint32_t ind=1;ind<info->vertices_info.n_of_vertices;ind++) {
+                aabb.min = (Vector2){fminf(aabb.min.x, vertices[ind].x), fminf(aabb.min.y, vertices[ind].y)};
+                aabb.max = (Vector2){fmaxf(aabb.max.x, vertices[ind].x), fmaxf(aabb.max.y, vertices[ind].y)};
+            }
+            break;
+        }
+        case COLLIDER_CIRCLE: {
+            float radius = info->circle_info.radius;
+            aabb.min = (Vector2){info->circle_info.offset.x-radius, info->circle_info.offset.y-radius};
+            aabb.max = (Vector2){info->circle_info.offset.x+radius, info->circle_info.offset.y+radius};
+            break;
+        }
+        default:
+            aabb.min = info->box_info.offset;
+            aabb.max = (Vector2){aabb.min.x+info->box_info.size.x, aabb.min.y+info->box_info.size.y};
+            break;
+    }
+    aabb.min = (Vector2){aabb.min.x+position.x, aabb.min.y+position.y};
+    aabb.max = (Vector2){aabb.max.x+position.x, aabb.max.y+position.y};
+    return aabb;
+}
+
+struct pipeline {
+    ContactCache contacts;
+    ColliderInfo *colliders;
+    Vector2 *positions;
+    size_t pairs;
+};
+
+static void pipeline_pair(uint32_t a, uint32_t b, void *udata) {
+    struct pipeline *pipeline = udata;
+    Contact *contact = contact_cache_get(&pipeline->contacts, a, b);
+    bool touching = narrowphase_collide(pipeline->positions[a], &pipeline->colliders[a], pipeline->positions[b], &pipeline->colliders[b], &contact->dir, contact->simplex, &contact->penetration);
+    contact_cache_report(&pipeline->contacts, contact, touching);
+    pipeline->pairs++;
+}
+
+// Full frame of the game's collision path: move, broadphase update, pairs, narrowphase through the contact cache.
+// A third each of boxes, circles and vertex rects bouncing in an area that keeps density constant.
+void bench_pipeline(enum broadphase_type type, size_t n_of_colliders, size_t frames) {
+    struct pipeline pipeline = {0};
+    pipeline.colliders = malloc(sizeof(ColliderInfo)*n_of_colliders);
+    pipeline.positions = malloc(sizeof(Vector2)*n_of_colliders);
+    Vector2 *velocities = malloc(sizeof(Vector2)*n_of_colliders);
+    float side = sqrtf(n_of_colliders)*25.f;
+    srand(1);
+    for(size_t ind=0;ind<n_of_colliders;ind++) {
+        if(ind%3==0) pipeline.colliders[ind] = new_box(10, 10);
+        else if(ind%3==1) pipeline.colliders[ind] = new_circle(6);
+        else pipeline.colliders[ind] = new_rect(10, 10);
+        pipeline.positions[ind] = (Vector2){rand()/(float)RAND_MAX*side, rand()/(float)RAND_MAX*side};
+        velocities[ind] = (Vector2){rand()%200/100.f-1.f, rand()%200/100.f-1.f};
+    }
+    Broadphase broadphase;
+    broadphase_init(&broadphase, type, 32.f, 4.f);
+    contact_cache_init(&pipeline.contacts);
+    BroadphaseFilter filter = {1, BROADPHASE_ALL_LAYERS};
+
+    size_t touching = 0;
+    size_t allocations_before = allocations;
+    double start = now_ns();
+    for(size_t frame=0;frame<frames;frame++) {
+        broadphase_begin(&broadphase);
+        for(size_t ind=0;ind<n_of_colliders;ind++) {
+            Vector2 *position = &pipeline.positions[ind];
+            position->x += velocities[ind].x;
+            position->y += velocities[ind].y;
+            if(position->x < 0 || position->x > side) velocities[ind].x = -velocities[ind].x;
+            if(position->y < 0 || position->y > side) velocities[ind].y = -velocities[ind].y;
+            broadphase_update(&broadphase, ind, collider_aabb(&pipeline.colliders[ind], *position), filter);
+        }
+        broadphase_end(&broadphase);
+        contact_cache_begin(&pipeline.contacts);
+        broadphase_pairs(&broadphase, pipeline_pair, &pipeline);
+        contact_cache_end(&pipeline.contacts);
+        for(ContactEvent *event=vec_begin(pipeline.contacts.events);event<vec_end(pipeline.contacts.events);event++) {
+            touching += event->type != CONTACT_END;
+        }
+    }
+    double elapsed = now_ns() - start;
+    size_t frame_allocations = allocations - allocations_before;
+    printf("pipeline broadphase=%s colliders=%zu frames=%zu ns_per_frame=%.0f pairs_per_frame=%.1f contacts_per_frame=%.1f allocations_per_frame=%.2f\n",
+        type == BROADPHASE_TREE ? "tree" : "grid", n_of_colliders, frames, elapsed/frames, (double)pipeline.pairs/frames, (double)touching/frames, (double)frame_allocations/frames);
+
+    broadphase_free(&broadphase);
+    contact_cache_free(&pipeline.contacts);
+    free(pipeline.colliders);
+    free(pipeline.positions);
+    free(velocities);
+}
+
+int main(void) {
+    printf("suite name=collision version=%s simd_width=%zu\n", BENCH_VERSION, support_simd_width());
+    bench_epa("rect_rect", new_rect(10, 10), new_rect(10, 10), 200000);
+    bench_epa("rect_circle", new_rect(10, 10), new_circle(6), 200000);
+    bench_epa("circle_circle", new_circle(6), new_circle(6), 200000);
+    // Same shapes through the closed form tests and through GJK/EPA as vertex polygons
+    bench_narrowphase("box_box", new_box(10, 10), new_box(10, 10), 1000000);
+    bench_narrowphase("rect_rect_gjk", new_rect(10, 10), new_rect(10, 10), 1000000);
+    bench_narrowphase("circle_box", new_circle(6), new_box(10, 10), 1000000);
+    bench_narrowphase("circle_rect_gjk", new_circle(6), new_rect(10, 10), 1000000);
+    bench_narrowphase("circle_circle", new_circle(6), new_circle(6), 1000000);
+    bench_support(4, 2000000);
+    bench_support(8, 2000000);
+    bench_support(32, 2000000);
+    size_t sizes[] = {100, 1000, 5000};
+    for(size_t ind=0;ind<sizeof(sizes)/sizeof(sizes[0]);ind++) {
+        bench_pipeline(BROADPHASE_GRID, sizes[ind], 200000/sizes[ind]+20);
+        bench_pipeline(BROADPHASE_TREE, sizes[ind], 200000/sizes[ind]+20);
+    }
+    vertex_pool_free();
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <time.h>
+#include "../include/kxecs.h"
+
+// Headless ECS benchmarks, build with `make bench`.
+// One result per line, the benchmark name followed by key=value pairs.
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+typedef struct {
+    float x, y;
+} C_Position;
+
+typedef struct {
+    float x, y;
+} C_Velocity;
+
+typedef struct {
+    int score;
+} C_Player;
+
+ecs_declare_component(C_Position);
+ecs_declare_component(C_Velocity);
+ecs_declare_component(C_Player);
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// Fixed seed so every run touches the same entities
+static uint32_t rng_state = 1;
+
+static uint32_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+void move_sys(ECS *ecs, entity_t entity_id) {
+    C_Position *position = ecs_get_component(ecs, entity_id, C_Position);
+    C_Velocity *velocity = ecs_get_component(ecs, entity_id, C_Velocity);
+    position->x += velocity->x * 0.016f;
+    position->y += velocity->y * 0.016f;
+}
+
+void move_batch_sys(ECS *ecs, EcsBatch *batch) {
+    C_Position *positions = ecs_batch_components(batch, C_Position);
+    C_Velocity *velocities = ecs_batch_components(batch, C_Velocity);
+    for(size_t ind=0;ind<batch->count;ind++) {
+        positions[ind].x += velocities[ind].x * 0.016f;
+        positions[ind].y += velocities[ind].y * 0.016f;
+    }
+}
+
+void player_sys(ECS *ecs, entity_t entity_id) {
+    C_Player *player = ecs_get_component(ecs, entity_id, C_Player);
+    player->score++;
+}
+
+ECS *new_bench_ecs(enum ecs_storage storage, size_t n_of_entities, bool batch) {
+    ECS *ecs = init_ecs_with_storage(storage);
+    ecs_register_component(ecs, C_Position);
+    ecs_register_component(ecs, C_Velocity);
+    ecs_register_component(ecs, C_Player);
+    for(size_t ind=0;ind<n_of_entities;ind++) {
+        entity_t entity_id = new_entity(ecs);
+        ecs_add_component(ecs, entity_id, C_Position, {(float)ind, 0});
+        ecs_add_component(ecs, entity_id, C_Velocity, {1, 1});
+        if(ind==0) ecs_add_component(ecs, entity_id, C_Player, {0});
+    }
+    if(batch) {
+        ecs_register_batch_system(ecs, ON_UPDATE, move_batch_sys, C_Position, C_Velocity);
+    }else {
+        ecs_register_component_system(ecs, ON_UPDATE, move_sys, C_Position, C_Velocity);
+    }
+    ecs_register_component_system(ecs, ON_UPDATE, player_sys, C_Player);
+    return ecs;
+}
+
+// Average cost of one ON_UPDATE phase
+static const char *storage_name(enum ecs_storage storage) {
+    return storage == ECS_STORAGE_ARCHETYPE ? "archetype" : "sparse_set";
+}
+
+void bench_query_iteration(enum ecs_storage storage, size_t n_of_entities, size_t frames, bool batch) {
+    ECS *ecs = new_bench_ecs(storage, n_of_entities, batch);
+    ecs_call_system(ecs, ON_UPDATE);
+
+    double start = now_ns();
+    for(size_t frame=0;frame<frames;frame++) {
+        ecs_call_system(ecs, ON_UPDATE);
+    }
+    double elapsed = now_ns() - start;
+    printf("%s storage=%s entities=%zu frames=%zu ns_per_frame=%.1f\n", batch ? "batch_iteration" : "query_iteration", storage_name(storage), n_of_entities, frames, elapsed/frames);
+    free_ecs(ecs);
+}
+
+// Cost of adding components one at a time, every add moves the entity to a new archetype in archetype storage
+void bench_structural_changes(enum ecs_storage storage, size_t n_of_entities, size_t rounds) {
+    double elapsed = 0;
+    for(size_t round=0;round<rounds;round++) {
+        ECS *ecs = init_ecs_with_storage(storage);
+        ecs_register_component(ecs, C_Position);
+        ecs_register_component(ecs, C_Velocity);
+        ecs_register_component(ecs, C_Player);
+
+        double start = now_ns();
+        for(size_t ind=0;ind<n_of_entities;ind++) {
+            entity_t entity_id = new_entity(ecs);
+            ecs_add_component(ecs, entity_id, C_Position, {(float)ind, 0});
+            ecs_add_component(ecs, entity_id, C_Velocity, {1, 1});
+            ecs_add_component(ecs, entity_id, C_Player, {0});
+        }
+        elapsed += now_ns() - start;
+        free_ecs(ecs);
+    }
+    printf("add_component storage=%s entities=%zu ns_per_add=%.1f\n", storage_name(storage), n_of_entities, elapsed/(rounds*n_of_entities*3));
+}
+
+static size_t deferred_spawn_count;
+
+void deferred_spawn_sys(ECS *ecs, entity_t _) {
+    for(size_t ind=0;ind<deferred_spawn_count;ind++) {
+        entity_t entity_id = new_entity(ecs);
+        ecs_add_component(ecs, entity_id, C_Position, {(float)ind, 0});
+        ecs_add_component(ecs, entity_id, C_Velocity, {1, 1});
+        ecs_add_component(ecs, entity_id, C_Player, {0});
+    }
+}
+
+// Same adds made from a system, recorded and applied in one sorted batch when the phase ends
+void bench_deferred_changes(enum ecs_storage storage, size_t n_of_entities, size_t rounds) {
+    double elapsed = 0;
+    deferred_spawn_count = n_of_entities;
+    for(size_t round=0;round<rounds;round++) {
+        ECS *ecs = init_ecs_with_storage(storage);
+        ecs_register_component(ecs, C_Position);
+        ecs_register_component(ecs, C_Velocity);
+        ecs_register_component(ecs, C_Player);
+        ecs_register_system(ecs, ON_START, deferred_spawn_sys);
+
+        double start = now_ns();
+        ecs_call_system(ecs, ON_START);
+        elapsed += now_ns() - start;
+        free_ecs(ecs);
+    }
+    printf("deferred_add_component storage=%s entities=%zu ns_per_add=%.1f\n", storage_name(storage), n_of_entities, elapsed/(rounds*n_of_entities*3));
+}
+
+// Half of the entities are erased and respawned with their components every round, ids come back through free_ids
+void bench_churn(enum ecs_storage storage, size_t n_of_entities, size_t rounds) {
+    ECS *ecs = new_bench_ecs(storage, n_of_entities, false);
+    entity_t *alive = malloc(sizeof(entity_t)*n_of_entities);
+    for(size_t ind=0;ind<n_of_entities;ind++) alive[ind] = ind;
+
+    double start = now_ns();
+    for(size_t round=0;round<rounds;round++) {
+        for(size_t ind=round%2;ind<n_of_entities;ind+=2) {
+            __ecs_erase_entity(ecs, alive[ind]);
+        }
+        for(size_t ind=round%2;ind<n_of_entities;ind+=2) {
+            entity_t entity_id = new_entity(ecs);
+            ecs_add_component(ecs, entity_id, C_Position, {(float)ind, 0});
+            ecs_add_component(ecs, entity_id, C_Velocity, {1, 1});
+            alive[ind] = entity_id;
+        }
+    }
+    double elapsed = now_ns() - start;
+    size_t churned = rounds*(n_of_entities/2);
+    printf("churn storage=%s entities=%zu rounds=%zu ns_per_respawn=%.1f\n", storage_name(storage), n_of_entities, rounds, elapsed/churned);
+    free(alive);
+    free_ecs(ecs);
+}
+
+// ecs_get_component on ids in random order, defeats the prefetching a system's dense iteration gets
+void bench_random_access(enum ecs_storage storage, size_t n_of_entities, size_t lookups) {
+    ECS *ecs = new_bench_ecs(storage, n_of_entities, false);
+    entity_t *ids = malloc(sizeof(entity_t)*lookups);
+    for(size_t ind=0;ind<lookups;ind++) ids[ind] = next_random() % n_of_entities;
+
+    float checksum = 0.f;
+    double start = now_ns();
+    for(size_t ind=0;ind<lookups;ind++) {
+        checksum += ecs_get_component(ecs, ids[ind], C_Position)->x;
+    }
+    double elapsed = now_ns() - start;
+    printf("random_access storage=%s entities=%zu lookups=%zu ns_per_lookup=%.2f checksum=%.0f\n", storage_name(storage), n_of_entities, lookups, elapsed/lookups, checksum);
+    free(ids);
+    free_ecs(ecs);
+}
+
+// Every entity carries a distinct tag, lookups are for random ones
+void bench_tag_lookup(size_t n_of_entities, size_t lookups) {
+    ECS *ecs = init_ecs();
+    ecs_register_component(ecs, C_Position);
+    char tag[32];
+    for(size_t ind=0;ind<n_of_entities;ind++) {
+        snprintf(tag, sizeof(tag), "entity_%zu", ind);
+        new_entity_with_tag(ecs, tag);
+    }
+    sds *queries = malloc(sizeof(sds)*lookups);
+    for(size_t ind=0;ind<lookups;ind++) {
+        snprintf(tag, sizeof(tag), "entity_%u", next_random() % (uint32_t)n_of_entities);
+        queries[ind] = sdsnew(tag);
+    }
+
+    size_t checksum = 0;
+    double start = now_ns();
+    for(size_t ind=0;ind<lookups;ind++) {
+        checksum += ecs_find_entity_with_tag(ecs, queries[ind]);
+    }
+    double elapsed = now_ns() - start;
+    printf("tag_lookup entities=%zu lookups=%zu ns_per_lookup=%.1f checksum=%zu\n", n_of_entities, lookups, elapsed/lookups, checksum);
+    for(size_t ind=0;ind<lookups;ind++) sdsfree(queries[ind]);
+    free(queries);
+    free_ecs(ecs);
+}
+
+void score_sys(ECS *ecs, entity_t entity_id) {
+    C_Player *player = ecs_get_component(ecs, entity_id, C_Player);
+    player->score = player->score*31 + 7;
+}
+
+static bool profile_samples_overlap(SystemCallback *a, SystemCallback *b) {
+    EcsProfileSample *sample_a = &a->profile.samples[(a->profile.next+ECS_PROFILE_WINDOW-1)%ECS_PROFILE_WINDOW];
+    EcsProfileSample *sample_b = &b->profile.samples[(b->profile.next+ECS_PROFILE_WINDOW-1)%ECS_PROFILE_WINDOW];
+    return sample_a->start < sample_b->start+sample_b->duration && sample_b->start < sample_a->start+sample_a->duration;
+}
+
+// Two systems writing different components in a parallel phase, with and without declared access.
+// Declared they can run at the same time, overlapped counts the frames whose profile samples intersect.
+void bench_scheduler(size_t n_of_entities, size_t frames, bool declared) {
+    ECS *ecs = init_ecs();
+    ecs_register_component(ecs, C_Position);
+    ecs_register_component(ecs, C_Velocity);
+    ecs_register_component(ecs, C_Player);
+    for(size_t ind=0;ind<n_of_entities;ind++) {
+        entity_t entity_id = new_entity(ecs);
+        ecs_add_component(ecs, entity_id, C_Position, {(float)ind, 0});
+        ecs_add_component(ecs, entity_id, C_Velocity, {1, 1});
+        ecs_add_component(ecs, entity_id, C_Player, {0});
+    }
+    ecs_register_component_system(ecs, ON_UPDATE, move_sys, C_Position, C_Velocity);
+    ecs_register_component_system(ecs, ON_UPDATE, score_sys, C_Player);
+    if(declared) {
+        ecs_set_system_access(ecs, ON_UPDATE, move_sys, ecs_components_mask(ecs, C_Velocity), ecs_components_mask(ecs, C_Position));
+        ecs_set_system_access(ecs, ON_UPDATE, score_sys, 0, ecs_components_mask(ecs, C_Player));
+    }
+    ecs_set_thread_count(ecs, 2);
+    ecs_set_parallel_phase(ecs, ON_UPDATE, true);
+    ecs_set_profiling(ecs, true);
+    ecs_call_system(ecs, ON_UPDATE);
+
+    size_t overlapped = 0;
+    double start = now_ns();
+    for(size_t frame=0;frame<frames;frame++) {
+        ecs_call_system(ecs, ON_UPDATE);
+        overlapped += profile_samples_overlap(&ecs->systems[ON_UPDATE][0], &ecs->systems[ON_UPDATE][1]);
+    }
+    double elapsed = now_ns() - start;
+    printf("scheduler access=%s entities=%zu frames=%zu ns_per_frame=%.1f overlapped=%zu\n", declared ? "declared" : "undeclared", n_of_entities, frames, elapsed/frames, overlapped);
+    free_ecs(ecs);
+}
+
+int main(void) {
+    printf("suite name=ecs version=%s\n", BENCH_VERSION);
+    size_t sizes[] = {1000, 5000, 50000};
+    enum ecs_storage storages[] = {ECS_STORAGE_SPARSE_SET, ECS_STORAGE_ARCHETYPE};
+    for(size_t ind=0;ind<sizeof(storages)/sizeof(storages[0]);ind++) {
+        bench_query_iteration(storages[ind], 10, 100000, false);
+        bench_query_iteration(storages[ind], 10, 100000, true);
+        for(size_t size=0;size<sizeof(sizes)/sizeof(sizes[0]);size++) {
+            size_t frames = 10000000/sizes[size];
+            bench_query_iteration(storages[ind], sizes[size], frames, false);
+            bench_query_iteration(storages[ind], sizes[size], frames, true);
+            bench_random_access(storages[ind], sizes[size], 1000000);
+            bench_churn(storages[ind], sizes[size], 20000000/sizes[size]/10);
+        }
+        bench_structural_changes(storages[ind], 5000, 50);
+        bench_deferred_changes(storages[ind], 5000, 50);
+    }
+    bench_scheduler(50000, 200, false);
+    bench_scheduler(50000, 200, true);
+    bench_tag_lookup(100, 100000);
+    bench_tag_lookup(1000, 20000);
+    intern_pool_free();
+    return 0;
+}
@@ -0,0 +1,159 @@
+#ifndef BROADPHASE_H
+#define BROADPHASE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include "raylib.h"
+
+typedef struct {
+    Vector2 min;
+    Vector2 max;
+} AABB;
+
+static inline bool aabb_overlap(AABB a, AABB b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y;
+}
+
+static inline bool aabb_contains_point(AABB a, Vector2 point) {
+    return point.x >= a.min.x && point.x <= a.max.x && point.y >= a.min.y && point.y <= a.max.y;
+}
+
+// Collision filtering, a proxy is only reported if each side's layer bits are in the other side's mask
+#define BROADPHASE_LAYERS 32
+#define BROADPHASE_ALL_LAYERS 0xFFFFFFFFu
+
+typedef struct {
+    uint32_t layer;
+    uint32_t mask;
+} BroadphaseFilter;
+
+static inline bool broadphase_filter_pass(BroadphaseFilter a, BroadphaseFilter b) {
+    return (a.layer & b.mask) && (b.layer & a.mask);
+}
+
+typedef struct {
+    uint32_t id;
+    AABB aabb;
+    BroadphaseFilter filter;
+} BroadphaseProxy;
+
+static inline AABB aabb_union(AABB a, AABB b) {
+    return (AABB){{fminf(a.min.x, b.min.x), fminf(a.min.y, b.min.y)}, {fmaxf(a.max.x, b.max.x), fmaxf(a.max.y, b.max.y)}};
+}
+
+static inline bool aabb_contains(AABB outer, AABB inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y;
+}
+
+static inline float aabb_perimeter(AABB a) {
+    return 2.f*((a.max.x-a.min.x) + (a.max.y-a.min.y));
+}
+
+// Slab test of the segment from -> to
+bool aabb_segment_overlap(AABB a, Vector2 from, Vector2 to);
+
+// Return false to stop the query
+typedef bool (*broadphase_query_func_t)(uint32_t id, void *udata);
+typedef void (*broadphase_pair_func_t)(uint32_t id_a, uint32_t id_b, void *udata);
+
+// Uniform grid, proxies are inserted every frame and spatial_hash_build sorts them by cell
+typedef struct {
+    int32_t cx;
+    int32_t cy;
+    uint32_t proxy;
+} SpatialHashEntry;
+
+typedef struct {
+    int32_t cx;
+    int32_t cy;
+    size_t start;
+    size_t count;
+} SpatialHashCell;
+
+typedef struct {
+    float cell_size;
+    BroadphaseProxy *proxies;
+    SpatialHashEntry *entries;
+    // Open addressing table of the non empty cells, count==0 marks a free slot
+    SpatialHashCell *cells;
+    size_t cells_capacity;
+} SpatialHash;
+
+void spatial_hash_init(SpatialHash *hash, float cell_size);
+void spatial_hash_free(SpatialHash *hash);
+void spatial_hash_clear(SpatialHash *hash);
+void spatial_hash_insert(SpatialHash *hash, uint32_t id, AABB aabb, BroadphaseFilter filter);
+void spatial_hash_build(SpatialHash *hash);
+// Every proxy whose AABB overlaps aabb and passes filter is reported once
+void spatial_hash_query(SpatialHash *hash, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+void spatial_hash_raycast(SpatialHash *hash, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+
+// Dynamic AABB tree, leaves hold AABBs fattened by margin so small moves don't touch the tree
+#define AABB_TREE_NULL -1
+
+typedef struct {
+    AABB aabb;
+    // Leaves only, the proxy's exact AABB. aabb is its fattened copy and only decides when to reinsert
+    AABB tight;
+    uint32_t id;
+    BroadphaseFilter filter;
+    // Next free node while the node is in the free list
+    int32_t parent;
+    int32_t child1;
+    int32_t child2;
+    // 0 for leaves, -1 for free nodes
+    int32_t height;
+    // Frame the leaf was last updated in, see broadphase_end
+    uint32_t frame;
+} AABBTreeNode;
+
+typedef struct {
+    AABBTreeNode *nodes;
+    int32_t root;
+    int32_t free_list;
+    float margin;
+} AABBTree;
+
+void aabb_tree_init(AABBTree *tree, float margin);
+void aabb_tree_free(AABBTree *tree);
+int32_t aabb_tree_create_proxy(AABBTree *tree, uint32_t id, AABB aabb, BroadphaseFilter filter);
+void aabb_tree_destroy_proxy(AABBTree *tree, int32_t proxy);
+// Returns true if the proxy left its fat AABB and got reinserted
+bool aabb_tree_move_proxy(AABBTree *tree, int32_t proxy, AABB aabb);
+void aabb_tree_query(AABBTree *tree, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+void aabb_tree_raycast(AABBTree *tree, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+
+// Broadphase, one of the above behind a common interface.
+// Every frame: broadphase_begin, broadphase_update for every live id, broadphase_end.
+enum broadphase_type {
+    BROADPHASE_GRID,
+    BROADPHASE_TREE
+};
+
+typedef struct {
+    enum broadphase_type type;
+    SpatialHash grid;
+    AABBTree tree;
+    // Tree proxy of every id, AABB_TREE_NULL if it has none
+    int32_t *tree_proxies;
+    uint32_t frame;
+    // Layers every layer is allowed to pair with, symmetric
+    uint32_t layer_pairs[BROADPHASE_LAYERS];
+} Broadphase;
+
+void broadphase_init(Broadphase *broadphase, enum broadphase_type type, float cell_size, float margin);
+void broadphase_free(Broadphase *broadphase);
+// Layers are indices into the pair matrix here, every pair collides by default
+void broadphase_set_layer_pair(Broadphase *broadphase, uint32_t layer_a, uint32_t layer_b, bool collide);
+void broadphase_begin(Broadphase *broadphase);
+void broadphase_update(Broadphase *broadphase, uint32_t id, AABB aabb, BroadphaseFilter filter);
+// Ids that weren't updated since broadphase_begin are removed
+void broadphase_end(Broadphase *broadphase);
+void broadphase_query(Broadphase *broadphase, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+void broadphase_raycast(Broadphase *broadphase, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata);
+// Every unordered pair of overlapping proxies that pass each other's filter, reported once with id_a < id_b
+void broadphase_pairs(Broadphase *broadphase, broadphase_pair_func_t callback, void *udata);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "raylib.h"
+#include "hashmap.h"
+
+enum ColliderType { COLLIDER_VERTICES, COLLIDER_CIRCLE, COLLIDER_BOX, COLLIDER_TYPES };
+
+typedef struct {
+    enum ColliderType collider_t;
+    union {
+        // Range of the shared vertex pool, positions are relative to object's position
+        struct {
+            uint32_t offset;
+            uint32_t n_of_vertices;
+        } vertices_info;
+        struct {
+            Vector2 offset;
+            float radius;
+        } circle_info;
+        // Axis aligned, offset is the top left corner
+        struct {
+            Vector2 offset;
+            Vector2 size;
+        } box_info;
+    };
+} ColliderInfo;
+
+// Shared vertex pool, identical vertex sets are stored once. Every set is padded to a multiple of
+// VERTEX_POOL_PADDING by repeating its last vertex so the SIMD support kernel needs no tail loop.
+// Adding can move the pool, so keep offsets rather than the returned pointers.
+#define VERTEX_POOL_PADDING 8
+
+uint32_t vertex_pool_add(const Vector2 *vertices, uint32_t n_of_vertices);
+const Vector2 *vertex_pool_vertices(uint32_t offset);
+size_t vertex_pool_size();
+void vertex_pool_free();
+ColliderInfo collider_info_vertices(const Vector2 *vertices, uint32_t n_of_vertices);
+
+Vector2 support_function_vertices(Vector2 position, const Vector2 *vertices, size_t n_of_vertices, Vector2 dir);
+// Same on SoA vertices, xs and ys are read up to n_of_vertices rounded up to VERTEX_POOL_PADDING.
+// AVX, SSE2 or scalar depending on what the build targets.
+Vector2 support_function_vertices_soa(Vector2 position, const float *xs, const float *ys, size_t n_of_vertices, Vector2 dir);
+size_t support_simd_width();
+Vector2 support_function_circle(Vector2 center, float radius, Vector2 dir);
+Vector2 support_function_box(Vector2 min, Vector2 size, Vector2 dir);
+Vector2 support_function(Vector2 position, const ColliderInfo *collider_info, Vector2 dir);
+
+// GJK on the Minkowski difference a-b. dir is the first search direction and receives the last one,
+// passing last frame's back makes pairs that stay apart exit after a single support call.
+// simplex receives the triangle enclosing the origin on a hit.
+bool gjk_intersect(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3]);
+
+// EPA polytope lives on the stack, it gains one vertex per iteration
+#define EPA_MAX_ITERATIONS 32
+#define EPA_MAX_VERTICES (3+EPA_MAX_ITERATIONS)
+#define EPA_TOLERANCE 0.0001f
+
+typedef struct {
+    // Points from a to b, moving a by -normal*depth separates the shapes
+    Vector2 normal;
+    float depth;
+    // Contact point, the deepest point of a inside b for EPA
+    Vector2 point;
+} Penetration;
+
+// Expands the simplex of a gjk_intersect hit at the same positions, never allocates
+Penetration epa_penetration(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 simplex[3]);
+
+// Narrowphase dispatch on both collider types. Circles and boxes get closed form tests,
+// pairs involving vertices go through GJK/EPA with dir and simplex as in gjk_intersect.
+// penetration is filled on a hit.
+typedef bool (*narrowphase_func_t)(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration);
+
+bool narrowphase_collide(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration);
+
+// Contact cache, persistent per unordered pair of ids. Ids should change when an entity is replaced,
+// otherwise the new one inherits the old contact and no end event is emitted.
+enum contact_event_type {
+    CONTACT_BEGIN,
+    CONTACT_STAY,
+    CONTACT_END
+};
+
+typedef struct {
+    enum contact_event_type type;
+    uint32_t a;
+    uint32_t b;
+} ContactEvent;
+
+typedef struct {
+    // a < b
+    uint32_t a;
+    uint32_t b;
+    bool touching;
+    // Warm start and coherence data of the last solve
+    bool solved;
+    Vector2 dir;
+    Vector2 simplex[3];
+    Penetration penetration;
+    Vector2 position_a;
+    Vector2 position_b;
+    // Last frame the pair was reported by the broadphase
+    uint32_t frame;
+} Contact;
+
+typedef struct {
+    struct hashmap *contacts;
+    // Events of the current frame, filled by contact_cache_report and contact_cache_end
+    ContactEvent *events;
+    // Scratch list of contact_cache_end
+    Contact *stale;
+    uint32_t frame;
+} ContactCache;
+
+void contact_cache_init(ContactCache *cache);
+void contact_cache_free(ContactCache *cache);
+void contact_cache_begin(ContactCache *cache);
+// Finds or creates the contact of the pair and marks it as alive this frame.
+// The pointer is only valid until the next contact_cache call.
+Contact *contact_cache_get(ContactCache *cache, uint32_t a, uint32_t b);
+Contact *contact_cache_find(ContactCache *cache, uint32_t a, uint32_t b);
+// Records the narrowphase result and the matching begin/stay/end event
+void contact_cache_report(ContactCache *cache, Contact *contact, bool touching);
+// Removes the pairs the broadphase didn't report this frame, touching ones get an end event
+void contact_cache_end(ContactCache *cache);
+
+#endif
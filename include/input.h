@@ -0,0 +1,82 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "raylib.h"
+
+// Clock and input the systems read instead of raylib's globals, so the game can run without a window
+typedef struct {
+    float (*frame_time)(void *udata);
+    bool (*key_down)(int key, void *udata);
+    bool (*key_pressed)(int key, void *udata);
+    // Screen space
+    Vector2 (*mouse_position)(void *udata);
+    bool (*mouse_down)(int button, void *udata);
+    bool (*mouse_pressed)(int button, void *udata);
+    // Called around every simulation tick, both may be NULL.
+    // begin_tick returning false means the source has no input left and the run should stop.
+    bool (*begin_tick)(void *udata);
+    void (*end_tick)(void *udata);
+    void *udata;
+} InputSource;
+
+#define INPUT_MAX_KEYS 512
+#define INPUT_MAX_BUTTONS 8
+
+void input_set_source(InputSource source);
+float input_frame_time();
+bool input_key_down(int key);
+bool input_key_pressed(int key);
+Vector2 input_mouse_position();
+bool input_mouse_down(int button);
+bool input_mouse_pressed(int button);
+bool input_begin_tick();
+void input_end_tick();
+
+#ifndef HEADLESS
+// Frame time is the fixed tick_dt, keys come from IsKeyDown and raylib's key queue.
+// input_raylib_poll latches the presses once per frame and they stay pressed until a tick ends,
+// so a frame running several ticks reports them once and a frame running none keeps them.
+InputSource input_raylib_source(float tick_dt);
+void input_raylib_poll();
+#endif
+
+// Fixed frame time, keys are whatever the owner sets between ticks, presses are cleared after each one
+typedef struct {
+    float dt;
+    bool down[INPUT_MAX_KEYS];
+    bool pressed[INPUT_MAX_KEYS];
+    Vector2 mouse_position;
+    bool mouse_down[INPUT_MAX_BUTTONS];
+    bool mouse_pressed[INPUT_MAX_BUTTONS];
+} FixedInput;
+
+InputSource input_fixed_source(FixedInput *input);
+
+// Replay log: a header with the RNG seed, then one record per tick with its dt, the mouse and the
+// keys held or pressed, stored as key code lists so idle ticks take a few bytes.
+// Recording wraps another source and snapshots it at the start of every tick, playback serves the
+// records back in order and ends the run once the log is exhausted. Fields are little endian and unpadded.
+#define INPUT_REPLAY_MAGIC 0x5052584Bu
+#define INPUT_REPLAY_VERSION 2
+
+typedef struct {
+    // Input of the current tick, first so the fixed source callbacks can read it
+    FixedInput tick;
+    FILE *file;
+    InputSource source;
+    uint32_t seed;
+    size_t ticks;
+} InputReplay;
+
+bool input_record_open(InputReplay *replay, const char *path, uint32_t seed);
+InputSource input_record_source(InputReplay *replay, InputSource source);
+// Reads the header, replay->seed has to be passed to srand before the first tick
+bool input_replay_open(InputReplay *replay, const char *path);
+InputSource input_replay_source(InputReplay *replay);
+void input_replay_close(InputReplay *replay);
+
+#endif
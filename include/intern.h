@@ -0,0 +1,16 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include "sds.h"
+
+// Global string pool, one immutable sds copy per distinct value so interned strings compare by pointer.
+// Copies live until intern_pool_free, which has to come after every ECS using them is freed. Not thread safe.
+const char *intern_string(const char *str);
+const char *intern_string_len(const char *str, size_t len);
+// The pooled copy, NULL if the value was never interned
+const char *intern_find(const char *str);
+size_t intern_pool_size();
+void intern_pool_free();
+
+#endif
@@ -2,28 +2,188 @@
 #include "hashmap.h"
 #include "sds.h"
 #include "sdsalloc.h"
+#include "intern.h"
+#include "kxjobs.h"
 
-#define MAX_ENTITIES 5000
 #define MAX_COMPONENTS 32
+#define MAX_RESOURCES 32
+// Entity indexed arrays grow a page at a time, component sparse sets allocate pages on first use
+#define ECS_PAGE_BITS 10
+#define ECS_PAGE_SIZE (1<<ECS_PAGE_BITS)
+#define ECS_PAGE_MASK (ECS_PAGE_SIZE-1)
+#define ECS_CHUNK_SIZE 16384
 
+// Handle: index in the low 24 bits, generation of that index in the high 8.
+// Erasing bumps the index's generation, so handles kept past an entity's death stop matching.
 typedef uint32_t entity_t;
+#define ECS_INDEX_BITS 24
+#define ECS_INDEX_MASK 0x00FFFFFFu
+#define ECS_NULL_ENTITY ((entity_t)-1)
 struct ECS;
 
+// Tag names are interned per ECS into small ids, 0 is reserved so zeroed entity slots mean untagged
+typedef uint32_t ecs_tag_t;
+#define ECS_NO_TAG 0
+
+typedef struct {
+    // Interned, tags with the same name compare equal by pointer
+    const char *name;
+    // Handles of every entity carrying the tag, unordered
+    entity_t *entities;
+} EcsTag;
+
 typedef struct {
     void *data;
     size_t size_of_component;
-    size_t *entity_to_ind;    
+    // Vec of pages, NULL until an entity of that page gets the component
+    size_t **entity_to_ind;
+    // Parallel to data, capacity grows with it
     size_t *ind_to_entity;
     uint32_t signature;
+    // Mask of the batch system group that orders this vec, 0 while no group owns it
+    uint32_t group_mask;
 } ComponentVec;
 
+// Archetype storage: entities with the same signature live together in fixed size chunks.
+// A chunk holds an entity id column followed by one column per component of the signature.
+typedef struct {
+    void *data;
+    size_t count;
+} EcsChunk;
+
+typedef struct {
+    uint32_t signature;
+    size_t chunk_capacity;
+    size_t chunk_bytes;
+    size_t column_offsets[MAX_COMPONENTS];
+    // Archetype reached by adding component id (+1, 0 if not known yet)
+    size_t add_edges[MAX_COMPONENTS];
+    EcsChunk *chunks;
+    size_t size;
+} EcsArchetype;
+
+typedef struct {
+    size_t archetype;
+    size_t chunk;
+    size_t index;
+} EcsEntityLocation;
+
+// Where a chunk's memory belongs, ECS::chunk_refs is sorted by data
+typedef struct {
+    void *data;
+    size_t archetype;
+    size_t chunk;
+} EcsChunkRef;
+
+enum ecs_storage {
+    ECS_STORAGE_SPARSE_SET,
+    ECS_STORAGE_ARCHETYPE
+};
+
+// Contiguous run of entities matching a batch system, components[id] points at the first component of each type in the mask
+typedef struct {
+    size_t count;
+    size_t *entities;
+    void *components[MAX_COMPONENTS];
+} EcsBatch;
+
+// Every call of a system or phase records a sample in a ring holding the last ECS_PROFILE_WINDOW
+#define ECS_PROFILE_WINDOW 128
+
+typedef struct {
+    // CLOCK_MONOTONIC nanoseconds
+    uint64_t start;
+    uint64_t duration;
+    // Entities the callback ran on, summed batch sizes for batch systems
+    size_t entities;
+    // jobs_worker_index() of the thread that ran it
+    size_t thread;
+} EcsProfileSample;
+
+typedef struct {
+    EcsProfileSample samples[ECS_PROFILE_WINDOW];
+    size_t next;
+    size_t count;
+} EcsProfile;
+
+// Summary of a profile's window
+typedef struct {
+    const char *name;
+    size_t samples;
+    double last_ms;
+    double min_ms;
+    double avg_ms;
+    double max_ms;
+    double avg_entities;
+} EcsTiming;
+
 typedef void (*component_func_t)(struct ECS*, entity_t);
+typedef void (*batch_func_t)(struct ECS*, EcsBatch*);
 typedef struct {
     component_func_t callback;
     uint32_t entity_mask;
-    sds *tags;
+    ecs_tag_t *tags;
+    batch_func_t batch_callback;
+    // Group size of a batch system, valid while it equals ECS::structure_version
+    size_t grouped_count;
+    uint64_t grouped_version;
+    // Runs callback on ranges of the matching entities across the thread pool
+    bool parallel;
+    // Components the system reads and writes, systems that didn't declare them run exclusively
+    uint32_t read_mask;
+    uint32_t write_mask;
+    // Same for resources, one bit per resource id
+    uint32_t resource_read_mask;
+    uint32_t resource_write_mask;
+    bool declared_access;
+    // Function name as written at registration
+    const char *name;
+    EcsProfile profile;
+    // Scratch a gathered batch reuses across calls, kept per system since disjoint systems run concurrently
+    size_t *gather_entities;
+    unsigned char *gather_columns;
 } SystemCallback;
 
+// Structural changes made inside systems are recorded per thread and applied on the calling thread after the phase.
+// The flush sorts them and applies them in the order of this enum: kills come before component changes so the
+// ones aimed at entities dying in the same phase get dropped, and a component both removed and added ends up added.
+enum ecs_command_type {
+    ECS_COMMAND_SPAWN,
+    ECS_COMMAND_KILL,
+    ECS_COMMAND_REMOVE_COMPONENT,
+    ECS_COMMAND_ADD_COMPONENT
+};
+#define ECS_COMMAND_TYPES (ECS_COMMAND_ADD_COMPONENT+1)
+
+typedef struct {
+    enum ecs_command_type type;
+    entity_t entity_id;
+    // Set on spawns with a tag, its name is stored as the data
+    size_t component_id;
+    // Component value or tag name, offset into EcsCommandBuffer::data
+    size_t data_offset;
+} EcsCommand;
+
+typedef struct {
+    EcsCommand *commands;
+    unsigned char *data;
+} EcsCommandBuffer;
+
+// Commands of every buffer flattened and sorted, data points at the component value
+typedef struct {
+    EcsCommand command;
+    const unsigned char *data;
+} EcsPendingCommand;
+
+// Node of a phase's dependency graph, a system can start once every earlier conflicting system finished
+typedef struct EcsSystemNode {
+    struct ECS *ecs;
+    SystemCallback *system;
+    struct EcsSystemNode **dependents;
+    size_t n_of_dependencies;
+    atomic_size_t remaining;
+} EcsSystemNode;
+
 #define NUM_OF_SYSTEM_TYPES 5
 enum system_type {
     ON_START,
@@ -34,40 +194,125 @@ enum system_type {
 };
 
 typedef struct ECS {
+    enum ecs_storage storage;
+    ComponentVec component_vecs[MAX_COMPONENTS];
+    // Only used with ECS_STORAGE_ARCHETYPE
+    EcsArchetype *archetypes;
+    EcsEntityLocation *entity_locations;
+    // Every chunk by address, maps a component pointer back to its chunk
+    EcsChunkRef *chunk_refs;
+    // Component name -> id, only used for name based reflection
     struct hashmap *components;
     uint32_t *signatures;
-    entity_t *entities_to_spawn;
-    entity_t *entities_to_kill;
+    // Current generation of every index, same size as signatures
+    uint8_t *generations;
     entity_t *free_ids;
-    sds *tags;
+    // Indices whose generation ran out, they are never handed out again
+    size_t retired_ids;
+    // Handing out ids from systems running on several threads
+    pthread_mutex_t spawn_lock;
+    // Tag name -> id, tag_table is indexed by id
+    struct hashmap *tag_ids;
+    EcsTag *tag_table;
+    // Tag of every index and its position in that tag's entities, same size as signatures
+    ecs_tag_t *tags;
+    uint32_t *tag_slots;
     SystemCallback *systems[NUM_OF_SYSTEM_TYPES];
+    // Scheduler, phases run serially unless they are marked parallel and there is a pool
+    JobPool *jobs;
+    uint32_t parallel_phases;
+    EcsSystemNode *schedules[NUM_OF_SYSTEM_TYPES];
+    bool schedule_dirty[NUM_OF_SYSTEM_TYPES];
+    // One per thread of jobs, indexed by jobs_pool_worker_index(jobs)
+    EcsCommandBuffer *command_buffers;
+    // Scratch list of ecs_flush_commands
+    EcsPendingCommand *pending_commands;
+    // Off by default, two clock reads per system call show up on small phases
+    bool profiling;
+    EcsProfile phase_profiles[NUM_OF_SYSTEM_TYPES];
+    // Trace timestamps are relative to init_ecs
+    uint64_t profile_epoch;
+
+    // Single global values, indexed by resource id
+    void *resources[MAX_RESOURCES];
 
     int number_of_components;
+    int number_of_resources;
     int number_of_entities;
+    // Bumped whenever components are added, removed or reordered
+    uint64_t structure_version;
 } ECS;
 
 struct component_kv {
-    char *name;
-    ComponentVec component_vec;
+    const char *name;
+    size_t id;
+};
+
+struct tag_kv {
+    const char *name;
+    ecs_tag_t id;
 };
 
 // ECS Main
 ECS *init_ecs();
+ECS *init_ecs_with_storage(enum ecs_storage storage);
 void free_ecs(ECS *ecs);
 // Components
+ComponentVec *ecs_get_component_vec_by_name(ECS *ecs, char *name);
+void __ecs_add_component(ECS *ecs, size_t component_id, entity_t entity_id, const void *component);
+void __ecs_remove_component(ECS *ecs, size_t component_id, entity_t entity_id);
 void __link_entity_with_component(ECS *ecs, ComponentVec *cvec, entity_t entity_id, size_t component);
+ComponentVec *__ecs_smallest_component_vec(ECS *ecs, uint32_t mask);
+size_t __ecs_group_components(ECS *ecs, uint32_t mask);
+// Resources
+size_t __ecs_register_resource(ECS *ecs, size_t size_of_resource, const void *resource);
 // Entities
+// Inside a system the handle is reserved right away, the entity gets its slots and components once the phase ends
 entity_t new_entity(ECS *ecs);
 entity_t new_entity_with_tag(ECS *ecs, char *tag);
-entity_t __ecs_get_entity_id(ECS *ecs, ComponentVec *cvec, void *component_ptr);
+void *__ecs_iter_components(ECS *ecs, size_t component_id);
+// Works on both storages, archetypes find the chunk holding the pointer
+entity_t __ecs_get_entity_id(ECS *ecs, size_t component_id, void *component_ptr);
+entity_t __ecs_find_entity_with_tag(ECS *ecs, const char *tag);
+// Tags
+// Id of the tag, registering it on first use
+ecs_tag_t ecs_tag_id(ECS *ecs, const char *tag);
+// ECS_NO_TAG if the name was never used
+ecs_tag_t ecs_lookup_tag(ECS *ecs, const char *tag);
+// Replaces the entity's tag, ECS_NO_TAG removes it
+void ecs_set_tag(ECS *ecs, entity_t entity_id, ecs_tag_t tag);
 void __ecs_erase_entity(ECS *ecs, entity_t entity_id);
+void ecs_kill_entity(ECS *ecs, entity_t entity_id);
 // Systems
 void ecs_call_system(ECS *ecs, enum system_type system_type);
+size_t __ecs_call_for_each(ECS *ecs, uint32_t mask, component_func_t callback);
+size_t __ecs_call_batches(ECS *ecs, SystemCallback *func);
+void ecs_set_thread_count(ECS *ecs, size_t n_of_threads);
+void ecs_set_parallel_phase(ECS *ecs, enum system_type system_type, bool parallel);
+void __ecs_set_system_access(ECS *ecs, enum system_type system_type, void *function, uint32_t read_mask, uint32_t write_mask);
+void __ecs_set_system_resource_access(ECS *ecs, enum system_type system_type, void *function, uint32_t read_mask, uint32_t write_mask);
+void ecs_flush_commands(ECS *ecs);
+// Profiling
+void ecs_set_profiling(ECS *ecs, bool profiling);
+EcsTiming ecs_system_timing(ECS *ecs, enum system_type system_type, size_t index);
+EcsTiming ecs_phase_timing(ECS *ecs, enum system_type system_type);
+const char *ecs_phase_name(enum system_type system_type);
+// Chrome trace event JSON of every sample still in the windows, phases on thread 0 around their systems
+bool ecs_dump_trace(ECS *ecs, const char *path);
 // Utility
 int component_compare(const void *a, const void *b, void *udata);
 uint64_t component_hash(const void *item, uint64_t seed0, uint64_t seed1);
+int tag_compare(const void *a, const void *b, void *udata);
+uint64_t tag_hash(const void *item, uint64_t seed0, uint64_t seed1);
 size_t sds_vector_find(sds *vec, sds value, size_t start);
 
+// Every component type gets a dense id cached in a global, so lookups are a plain array index.
+// Components are declared once at file scope in one .c file, other files that use them need
+// ecs_extern_component (usually in a shared header). They have to be registered in the same order on every ECS.
+#define ecs_declare_component(component) size_t __ecs_component_id_##component = -1
+#define ecs_extern_component(component) extern size_t __ecs_component_id_##component
+#define ecs_component_id(component) __ecs_component_id_##component
+
 #define ecs_register_component(ecs, component)\
     do { \
         ComponentVec cvec = {0};\
@@ -75,38 +320,82 @@ size_t sds_vector_find(sds *vec, sds value, size_t start);
         vec_init(vec, 16);\
         cvec.data = vec;\
         cvec.size_of_component = sizeof(component);\
-        vec_init(cvec.entity_to_ind, MAX_ENTITIES);\
-        vec_init(cvec.ind_to_entity, MAX_ENTITIES);\
+        vec_init(cvec.entity_to_ind, 4);\
+        vec_init(cvec.ind_to_entity, 16);\
         cvec.signature = 1<<ecs->number_of_components;\
-        hashmap_set(ecs->components, &(struct component_kv){ #component, cvec }); \
+        ecs->component_vecs[ecs->number_of_components] = cvec;\
+        ecs_component_id(component) = ecs->number_of_components;\
+        hashmap_set(ecs->components, &(struct component_kv){ intern_string(#component), ecs->number_of_components }); \
         ecs->number_of_components++;\
     }while(0)
 
-#define __ecs_get_id(entity_id) (entity_id & 0x0FFF)
-//#define __ecs_get_generation(entity_id) ((entity_id & 0xF000)>>24)
+// Resources are typed globals owned by the ECS, camera or player handle, ids work like component ids
+// (declared once, ecs_extern_resource elsewhere). The value is copied into its own allocation, pointers
+// to it stay valid until free_ecs. Registering more than MAX_RESOURCES leaves the id at -1.
+#define ecs_declare_resource(resource) size_t __ecs_resource_id_##resource = -1
+#define ecs_extern_resource(resource) extern size_t __ecs_resource_id_##resource
+#define ecs_resource_id(resource) __ecs_resource_id_##resource
+
+#define ecs_register_resource(ecs, resource, ...)\
+    do {\
+        resource n_resource = __VA_ARGS__;\
+        ecs_resource_id(resource) = __ecs_register_resource(ecs, sizeof(resource), &n_resource);\
+    }while(0)
+
+#define ecs_get_resource(ecs, resource) ((resource*)(ecs)->resources[ecs_resource_id(resource)])
+
+#define __ecs_get_id(entity_id) ((entity_id) & ECS_INDEX_MASK)
+#define __ecs_get_generation(entity_id) ((entity_id) >> ECS_INDEX_BITS)
+#define __ecs_make_handle(id, generation) (((entity_t)(generation) << ECS_INDEX_BITS) | (entity_t)(id))
+#define ecs_entity_index(entity_id) __ecs_get_id(entity_id)
+#define ecs_entity_generation(entity_id) __ecs_get_generation(entity_id)
+// Current handle of an index, for ids coming back from places that only keep indices
+#define ecs_entity_at(ecs, index) __ecs_make_handle(index, (ecs)->generations[index])
+// Dense index of an entity's component, the entity has to have it
+#define __ecs_sparse_index(cvec, id) ((cvec)->entity_to_ind[(id)>>ECS_PAGE_BITS][(id)&ECS_PAGE_MASK])
 
 #define ecs_add_component(ecs, entity_id, component, ...) \
     do {\
-        ComponentVec *cvec = __ecs_get_component_vec(ecs, component);\
-        __link_entity_with_component(ecs, cvec, entity_id, vec_size(cvec->data));\
-        component *vec = cvec->data;\
         component n_component = __VA_ARGS__;\
-        vec_push(vec, n_component);\
-        cvec->data=vec;\
+        __ecs_add_component(ecs, ecs_component_id(component), entity_id, &n_component);\
     }while(0)
 
-#define ecs_get_component(ecs, entity_id, component)\
-    &(((component*)__ecs_get_component_vec(ecs, component)->data)[__ecs_get_component_vec(ecs, component)->entity_to_ind[__ecs_get_id(entity_id)]]);
+#define ecs_remove_component(ecs, entity_id, component) __ecs_remove_component(ecs, ecs_component_id(component), entity_id)
+
+// False for ECS_NULL_ENTITY and for handles whose entity got erased, even if the index was reused since.
+// The generation is 8 bits, an index is retired once it reaches 255 so stale handles never match again.
+static inline bool ecs_is_alive(ECS *ecs, entity_t entity_id) {
+    return __ecs_get_id(entity_id) < vec_size(ecs->generations) && ecs->generations[__ecs_get_id(entity_id)] == __ecs_get_generation(entity_id);
+}
 
-#define __ecs_get_component_vec(ecs, component) \
-    ((ComponentVec*)&(((struct component_kv*)hashmap_get(ecs->components, &(struct component_kv){.name=#component}))->component_vec))
+static inline void *__ecs_archetype_get_component(ECS *ecs, size_t component_id, entity_t entity_id) {
+    EcsEntityLocation location = ecs->entity_locations[__ecs_get_id(entity_id)];
+    EcsArchetype *archetype = &ecs->archetypes[location.archetype];
+    return archetype->chunks[location.chunk].data + archetype->column_offsets[component_id] + ecs->component_vecs[component_id].size_of_component*location.index;
+}
+
+static inline void *__ecs_get_component(ECS *ecs, size_t component_id, entity_t entity_id) {
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) return __ecs_archetype_get_component(ecs, component_id, entity_id);
+    ComponentVec *cvec = &ecs->component_vecs[component_id];
+    return cvec->data + cvec->size_of_component*__ecs_sparse_index(cvec, __ecs_get_id(entity_id));
+}
+
+#define ecs_get_component(ecs, entity_id, component) ((component*)__ecs_get_component(ecs, ecs_component_id(component), entity_id))
+
+#define __ecs_get_component_vec(ecs, component) (&(ecs)->component_vecs[ecs_component_id(component)])
 
 #define ecs_get_component_signature(ecs, component) __ecs_get_component_vec(ecs,component)->signature
 #define ecs_get_signature(ecs, entity_id) ecs->signatures[__ecs_get_id(entity_id)]
-#define ecs_get_tag(ecs, entity_id) ecs->tags[__ecs_get_id(entity_id)]
+#define ecs_get_tag_id(ecs, entity_id) ecs->tags[__ecs_get_id(entity_id)]
+// Name of the entity's tag, NULL if it has none
+#define ecs_get_tag(ecs, entity_id) ecs->tag_table[ecs_get_tag_id(ecs, entity_id)].name
+#define ecs_has_tag(ecs, entity_id, tag) (ecs_get_tag_id(ecs, entity_id) == (tag))
+// Vec of the handles carrying the tag
+#define ecs_tagged_entities(ecs, tag) ecs->tag_table[tag].entities
 
-#define ecs_iter_components(ecs, component)\
-    (component*)((ComponentVec)((struct component_kv*)hashmap_get(ecs->components, &(struct component_kv){.name=#component}))->component_vec).data
+// Dense array of every component of that type. Archetype storage has no such array and fails an assert,
+// iterate it with a batch system instead.
+#define ecs_iter_components(ecs, component) ((component*)__ecs_iter_components(ecs, ecs_component_id(component)))
 
 #define __component_to_signature(ecs, component) __ecs_get_component_vec(ecs, component)->signature
 #define __bitor_component_signatures_1(ecs, component) __component_to_signature(ecs, component)
@@ -116,19 +405,36 @@ size_t sds_vector_find(sds *vec, sds value, size_t start);
 #define __bitor_component_signatures_5(ecs, component, ...) __component_to_signature(ecs, component) | __bitor_component_signatures_4(ecs, __VA_ARGS__)
 #define __choose_correct_bitor(_1,_2,_3,_4,_5,name,...) name
 
+#define ecs_components_mask(ecs, ...) (__choose_correct_bitor(__VA_ARGS__, __bitor_component_signatures_5, __bitor_component_signatures_4, __bitor_component_signatures_3, __bitor_component_signatures_2, __bitor_component_signatures_1)(ecs, __VA_ARGS__))
+
+#define __resource_to_bit(resource) ((uint32_t)1<<ecs_resource_id(resource))
+#define __bitor_resource_bits_1(resource) __resource_to_bit(resource)
+#define __bitor_resource_bits_2(resource, ...) __resource_to_bit(resource) | __bitor_resource_bits_1(__VA_ARGS__)
+#define __bitor_resource_bits_3(resource, ...) __resource_to_bit(resource) | __bitor_resource_bits_2(__VA_ARGS__)
+#define __bitor_resource_bits_4(resource, ...) __resource_to_bit(resource) | __bitor_resource_bits_3(__VA_ARGS__)
+#define __bitor_resource_bits_5(resource, ...) __resource_to_bit(resource) | __bitor_resource_bits_4(__VA_ARGS__)
+
+#define ecs_resources_mask(ecs, ...) (__choose_correct_bitor(__VA_ARGS__, __bitor_resource_bits_5, __bitor_resource_bits_4, __bitor_resource_bits_3, __bitor_resource_bits_2, __bitor_resource_bits_1)(__VA_ARGS__))
+
+// Declares what an already registered system touches, e.g.
+// ecs_set_system_access(ecs, ON_UPDATE, enemy_ai_sys, ecs_components_mask(ecs, C_Transform, C_EnemyAI), ecs_components_mask(ecs, C_Velocity));
+#define ecs_set_system_access(ecs, type, function, reads, writes) __ecs_set_system_access(ecs, type, (void*)function, reads, writes)
+// Resources a system with declared access touches, e.g.
+// ecs_set_system_resource_access(ecs, ON_UPDATE, player_movement_sys, ecs_resources_mask(ecs, R_Input), 0);
+// The scheduler only knows what's declared, state outside the ECS has to live in a resource to be shared
+// between systems that run in parallel.
+#define ecs_set_system_resource_access(ecs, type, function, reads, writes) __ecs_set_system_resource_access(ecs, type, (void*)function, reads, writes)
+
 #define ecs_foreach_entity(ecs, function, ...)\
     do {\
         uint32_t mask = __choose_correct_bitor(__VA_ARGS__, __bitor_component_signatures_5, __bitor_component_signatures_4, __bitor_component_signatures_3, __bitor_component_signatures_2, __bitor_component_signatures_1)(ecs, __VA_ARGS__);\
-        for(size_t n=0;n<MAX_ENTITIES; n++) {\
-            if((ecs->signatures[n] & mask) == mask) {\
-                function(ecs, n);\
-            }\
-        }\
+        __ecs_call_for_each(ecs, mask, function);\
     }while(0)
 
 #define ecs_register_system(ecs, type, function) \
     do {\
         SystemCallback callback = {function, 0, NULL};\
+        callback.name = #function;\
         vec_push(ecs->systems[type],callback);\
     }while(0)
 
@@ -136,23 +442,50 @@ size_t sds_vector_find(sds *vec, sds value, size_t start);
     do {\
         uint32_t mask = __choose_correct_bitor(__VA_ARGS__, __bitor_component_signatures_5, __bitor_component_signatures_4, __bitor_component_signatures_3, __bitor_component_signatures_2, __bitor_component_signatures_1)(ecs, __VA_ARGS__);\
         SystemCallback callback = {function, mask, NULL};\
+        callback.name = #function;\
+        vec_push(ecs->systems[type],callback);\
+    }while(0)
+
+// Per entity system whose matching entities are split into ranges run on the thread pool.
+// The callback must only touch its own entity's components.
+#define ecs_register_parallel_system(ecs, type, function, ...)\
+    do {\
+        uint32_t mask = __choose_correct_bitor(__VA_ARGS__, __bitor_component_signatures_5, __bitor_component_signatures_4, __bitor_component_signatures_3, __bitor_component_signatures_2, __bitor_component_signatures_1)(ecs, __VA_ARGS__);\
+        SystemCallback callback = {function, mask, NULL};\
+        callback.parallel = true;\
+        callback.name = #function;\
+        vec_push(ecs->systems[type],callback);\
+    }while(0)
+
+// Called once per frame with all matching components packed at the same indices of their dense arrays.
+// Sparse sets are reordered for the first batch system over a vec, later ones whose masks overlap it
+// get a gathered copy that is written back after the call. Archetypes get one call per chunk.
+#define ecs_register_batch_system(ecs, type, function, ...)\
+    do {\
+        uint32_t mask = __choose_correct_bitor(__VA_ARGS__, __bitor_component_signatures_5, __bitor_component_signatures_4, __bitor_component_signatures_3, __bitor_component_signatures_2, __bitor_component_signatures_1)(ecs, __VA_ARGS__);\
+        SystemCallback callback = {NULL, mask, NULL, function, 0, -1};\
+        callback.name = #function;\
         vec_push(ecs->systems[type],callback);\
     }while(0)
 
+#define ecs_batch_components(batch, component) ((component*)(batch)->components[ecs_component_id(component)])
+
 #define ecs_register_tag_system(ecs, type, function, ...)\
     do {\
         char* tags[] = {__VA_ARGS__};\
-        sds *stags = NULL;\
-        vec_init(stags, 8);\
+        ecs_tag_t *tag_ids = NULL;\
+        vec_init(tag_ids, 8);\
         SystemCallback callback = {function, 0};\
         for(size_t ind=0;ind<sizeof(tags)/sizeof(tags[0]);ind++) {\
-            sds tag=sdsnew(tags[ind]);\
-            vec_push(stags, tag);\
+            ecs_tag_t tag = ecs_tag_id(ecs, tags[ind]);\
+            vec_push(tag_ids, tag);\
         }\
-        callback.tags = stags;\
+        callback.tags = tag_ids;\
+        callback.name = #function;\
         vec_push(ecs->systems[type],callback);\
     }while(0)
 
-#define ecs_get_entity_id(ecs, component_type, component_ptr) __ecs_get_entity_id(ecs, __ecs_get_component_vec(ecs,component_type), component_ptr)
-#define ecs_find_entity_with_tag(ecs, tag) sds_vector_find(ecs->tags, tag, 0)
-#define kill_entity(ecs, entity_id) vec_push(ecs->entities_to_kill, entity_id)
+#define ecs_get_entity_id(ecs, component_type, component_ptr) __ecs_get_entity_id(ecs, ecs_component_id(component_type), component_ptr)
+// Handle of an entity with the tag, ECS_NULL_ENTITY if there is none
+#define ecs_find_entity_with_tag(ecs, tag) __ecs_find_entity_with_tag(ecs, tag)
+#define kill_entity(ecs, entity_id) ecs_kill_entity(ecs, entity_id)
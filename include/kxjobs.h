@@ -0,0 +1,59 @@
+#ifndef KXJOBS_H
+#define KXJOBS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*job_func_t)(void *data);
+
+typedef struct {
+    job_func_t func;
+    void *data;
+    // Decremented when the job finishes, if set
+    atomic_size_t *counter;
+} Job;
+
+// Ring buffer deque, the owner pushes and pops at the tail, thieves take from the head
+typedef struct {
+    pthread_mutex_t lock;
+    Job *ring;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+} JobQueue;
+
+// Work stealing thread pool. Queue 0 belongs to the thread that created the pool,
+// it runs jobs too while it waits in jobs_wait.
+typedef struct JobPool {
+    pthread_t *threads;
+    JobQueue *queues;
+    size_t n_of_queues;
+    atomic_size_t queued;
+    atomic_size_t pending;
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    // Threads in jobs_wait with nothing left to take sleep on done until a counter drains or a job is pushed
+    pthread_cond_t done;
+    size_t waiting;
+    bool stop;
+} JobPool;
+
+JobPool *jobs_init(size_t n_of_workers);
+void jobs_free(JobPool *pool);
+// Safe to call from inside a job, the job lands in the calling worker's queue
+void jobs_push(JobPool *pool, job_func_t func, void *data);
+void jobs_push_counted(JobPool *pool, job_func_t func, void *data, atomic_size_t *counter);
+// Runs jobs on the calling thread until every pushed job has finished
+void jobs_wait(JobPool *pool);
+// Same but only waits for the jobs of counter, safe to call from inside a job
+void jobs_wait_counter(JobPool *pool, atomic_size_t *counter);
+// 0 on the thread owning the pool, 1..n on workers
+size_t jobs_worker_index();
+// Same but only counts workers of pool, any other thread (or a NULL pool) is 0.
+// Use it to index per thread data of a pool, workers of another pool can have higher indices.
+size_t jobs_pool_worker_index(JobPool *pool);
+size_t jobs_hardware_threads();
+
+#endif
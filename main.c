@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <math.h>
 #include "include/kxecs.h"
+#include "include/broadphase.h"
+#include "include/collision.h"
+#include "include/input.h"
 #include "raylib.h"
 #include "raymath.h"
 #include "rlgl.h"
@@ -11,41 +14,38 @@
 
 #define SCREEN_WIDTH 800
 #define SCREEN_HEIGHT 450
+// ON_PREUPDATE and ON_UPDATE run at a fixed rate, rendering runs at whatever rate it can
+#define TICK_RATE 60
+#define TICK_DT (1.f/TICK_RATE)
+// Past this the backlog is dropped instead of letting slow ticks pile up
+#define MAX_TICKS_PER_FRAME 8
 
 typedef struct {
   Vector2 position;
   Vector2 size;
-  float speed;
-  Vector2 velocity;
+  // Position at the start of the current tick, drawing interpolates from it
+  Vector2 prev_position;
 } C_Transform;
 
-enum ColliderType { COLLIDER_VERTICES, COLLIDER_CIRCLE };
-
+// Kept apart from C_Transform so steering systems don't write what collision reads
 typedef struct {
-    enum ColliderType collider_t;
-    union {
-        // Vertices' positions are relative to object's position
-        // TODO: Not fixed amount of vertices
-        struct {
-            Vector2 vertices[32];
-            size_t n_of_vertices;
-        } vertices_info;
-        struct {
-            Vector2 offset;
-            float radius;
-        } circle_info;
-    };
-} ColliderInfo;
+  float speed;
+  Vector2 velocity;
+} C_Velocity;
 
 typedef struct {
     ColliderInfo collider_info;
     enum ColliderType collider_t;
-    long layer;
-    long layer_mask;
+    // Bits of enum CollisionLayer
+    uint32_t layer;
+    uint32_t layer_mask;
     bool is_colliding;
     Vector2 simplex[3];
 } C_Collider;
 
+enum CollisionLayer { LAYER_PLAYER, LAYER_ENEMY, LAYER_WORLD };
+#define LAYER_BIT(layer) (1u<<(layer))
+
 enum ShapeType {RECT, CIRCLE};
 typedef struct {
     Color color;
@@ -54,10 +54,10 @@ typedef struct {
     enum ShapeType shape_t;
 } C_Renderer;
 
+// Chases its target until that dies, then stops
 typedef struct {
-    Camera2D camera;
-    char *following_tag;
-} C_Camera;
+    entity_t target;
+} C_EnemyAI;
 
 typedef struct {
     Vector2 start;
@@ -65,11 +65,61 @@ typedef struct {
     Vector2 pen_vec;
 } C_Debug;
 
-C_Transform new_transform(Vector2 position, Vector2 size, float speed) {
-    return (C_Transform){position, size, speed, (Vector2){0, 0}};
+ecs_declare_component(C_Transform);
+ecs_declare_component(C_Renderer);
+ecs_declare_component(C_Collider);
+ecs_declare_component(C_Debug);
+ecs_declare_component(C_EnemyAI);
+ecs_declare_component(C_Velocity);
+
+typedef struct {
+    Camera2D camera;
+    // Kept centered while alive
+    entity_t following;
+} R_Camera;
+
+typedef struct {
+    entity_t entity;
+} R_Player;
+
+typedef struct {
+    // Length of the current tick
+    float dt;
+    // Fraction of a tick the accumulator holds past the last one, 0..1
+    float alpha;
+} R_Time;
+
+// What the simulation reads from the input source, sampled once at the start of every tick
+typedef struct {
+    Vector2 move;
+    Vector2 mouse_position;
+    bool spawn;
+    bool click;
+} R_Input;
+
+// Proxies are rebuilt every tick, contacts persist across ticks
+typedef struct {
+    Broadphase broadphase;
+    ContactCache contacts;
+    // Largest transform size among the colliders of this tick, picking grows its query by it
+    Vector2 largest_size;
+} R_Physics;
+
+ecs_declare_resource(R_Camera);
+ecs_declare_resource(R_Player);
+ecs_declare_resource(R_Time);
+ecs_declare_resource(R_Input);
+ecs_declare_resource(R_Physics);
+
+C_Transform new_transform(Vector2 position, Vector2 size) {
+    return (C_Transform){position, size, position};
+}
+
+Vector2 transform_interpolated(C_Transform *transform, float alpha) {
+    return Vector2Lerp(transform->prev_position, transform->position, alpha);
 }
 
-C_Collider new_collider_circle(float cx, float cy, float radius, long layer, long layer_mask) {
+C_Collider new_collider_circle(float cx, float cy, float radius, uint32_t layer, uint32_t layer_mask) {
     C_Collider nc = {0};
     nc.collider_info.collider_t = COLLIDER_CIRCLE;
     nc.collider_info.circle_info.offset = (Vector2){cx,cy};
@@ -78,19 +128,61 @@ C_Collider new_collider_circle(float cx, float cy, float radius, long layer, lon
     nc.layer_mask = layer_mask;
     return nc;
 }
-C_Collider new_collider_rect(float x, float y, float width, float height, long layer, long layer_mask) {
+C_Collider new_collider_rect(float x, float y, float width, float height, uint32_t layer, uint32_t layer_mask) {
     C_Collider nc = {0};
-    nc.collider_info.collider_t = COLLIDER_VERTICES;
-    nc.collider_info.vertices_info.n_of_vertices = 4;
-    nc.collider_info.vertices_info.vertices[0] = (Vector2){0,0};
-    nc.collider_info.vertices_info.vertices[1] = (Vector2){width,0};
-    nc.collider_info.vertices_info.vertices[2] = (Vector2){width,height};
-    nc.collider_info.vertices_info.vertices[3] = (Vector2){0,height};
+    nc.collider_info.collider_t = COLLIDER_BOX;
+    nc.collider_info.box_info.offset = (Vector2){x,y};
+    nc.collider_info.box_info.size = (Vector2){width,height};
 
     nc.layer = layer;
     nc.layer_mask = layer_mask;
     return nc;
 }
+// Vertices are relative to the object's position, identical shapes share their vertices
+C_Collider new_collider_polygon(const Vector2 *vertices, uint32_t n_of_vertices, uint32_t layer, uint32_t layer_mask) {
+    C_Collider nc = {0};
+    nc.collider_info = collider_info_vertices(vertices, n_of_vertices);
+    nc.layer = layer;
+    nc.layer_mask = layer_mask;
+    return nc;
+}
+AABB collider_aabb(C_Collider *collider, Vector2 position) {
+    AABB aabb;
+    switch(collider->collider_info.collider_t) {
+        case COLLIDER_VERTICES: {
+            const Vector2 *vertices = vertex_pool_vertices(collider->collider_info.vertices_info.offset);
+            aabb.min = aabb.max = vertices[0];
+            for(size_t ind=1;ind<collider->collider_info.vertices_info.n_of_vertices;ind++) {
+                Vector2 v = vertices[ind];
+                aabb.min = (Vector2){fminf(aabb.min.x, v.x), fminf(aabb.min.y, v.y)};
+                aabb.max = (Vector2){fmaxf(aabb.max.x, v.x), fmaxf(aabb.max.y, v.y)};
+            }
+            break;
+        }
+        case COLLIDER_CIRCLE: {
+            Vector2 c = collider->collider_info.circle_info.offset;
+            float r = collider->collider_info.circle_info.radius;
+            aabb.min = (Vector2){c.x-r, c.y-r};
+            aabb.max = (Vector2){c.x+r, c.y+r};
+            break;
+        }
+        case COLLIDER_BOX:
+            aabb.min = collider->collider_info.box_info.offset;
+            aabb.max = Vector2Add(aabb.min, collider->collider_info.box_info.size);
+            break;
+        default:
+            aabb.min = aabb.max = (Vector2){0,0};
+            break;
+    }
+    aabb.min = Vector2Add(aabb.min, position);
+    aabb.max = Vector2Add(aabb.max, position);
+    return aabb;
+}
+
+BroadphaseFilter collider_filter(C_Collider *collider) {
+    return (BroadphaseFilter){collider->layer, collider->layer_mask};
+}
+
 /* TODO LIST */
 /*
     - Tags for systems:
@@ -106,396 +198,570 @@ C_Collider new_collider_rect(float x, float y, float width, float height, long l
     - OnEntityDelete component hook
     - https://www.researchgate.net/publication/228574502_How_to_implement_a_pressure_soft_body_model
     - More Flexible Entity Management
-    - Better Kill & Spawn System
     - Gameplay
 */
 
-void player_movement_sys(ECS *ecs, entity_t entity_id) {
-    Vector2 player_dir = {0};
-    if (IsKeyDown(KEY_W)) {
-        player_dir.y = -1;
+// First system of every tick, the rest of the tick reads R_Input and R_Time instead of the input source
+void read_input_sys(ECS *ecs, entity_t _) {
+    ecs_get_resource(ecs, R_Time)->dt = input_frame_time();
+    R_Input *input = ecs_get_resource(ecs, R_Input);
+    Vector2 move = {0};
+    if (input_key_down(KEY_W)) {
+        move.y = -1;
     }
-    if (IsKeyDown(KEY_S)) {
-        player_dir.y = 1;
+    if (input_key_down(KEY_S)) {
+        move.y = 1;
     }
-    if (IsKeyDown(KEY_A)) {
-        player_dir.x = -1;
+    if (input_key_down(KEY_A)) {
+        move.x = -1;
     }
-    if (IsKeyDown(KEY_D)) {
-        player_dir.x = 1;
+    if (input_key_down(KEY_D)) {
+        move.x = 1;
     }
-    C_Transform *player_transform = ecs_get_component(ecs, entity_id, C_Transform);
-    player_transform->velocity = Vector2Scale(Vector2Normalize(player_dir), player_transform->speed);
+    input->move = move;
+    input->mouse_position = input_mouse_position();
+    input->spawn = input_key_pressed(KEY_N);
+    input->click = input_mouse_pressed(MOUSE_BUTTON_LEFT);
 }
 
-void apply_velocity_sys(ECS *ecs, entity_t entity_id) {
-    C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
-    transform->position = Vector2Add(transform->position, Vector2Scale(transform->velocity, GetFrameTime()));
+void player_movement_sys(ECS *ecs, entity_t entity_id) {
+    Vector2 player_dir = ecs_get_resource(ecs, R_Input)->move;
+    C_Velocity *player_velocity = ecs_get_component(ecs, entity_id, C_Velocity);
+    player_velocity->velocity = Vector2Scale(Vector2Normalize(player_dir), player_velocity->speed);
+}
+
+void snapshot_transforms_sys(ECS *ecs, EcsBatch *batch) {
+    C_Transform *transforms = ecs_batch_components(batch, C_Transform);
+    for(size_t ind=0;ind<batch->count;ind++) {
+        transforms[ind].prev_position = transforms[ind].position;
+    }
+}
+
+void apply_velocity_sys(ECS *ecs, EcsBatch *batch) {
+    C_Transform *transforms = ecs_batch_components(batch, C_Transform);
+    C_Velocity *velocities = ecs_batch_components(batch, C_Velocity);
+    float dt = ecs_get_resource(ecs, R_Time)->dt;
+    for(size_t ind=0;ind<batch->count;ind++) {
+        transforms[ind].position.x += velocities[ind].velocity.x * dt;
+        transforms[ind].position.y += velocities[ind].velocity.y * dt;
+    }
 }
 
 void enemy_ai_sys(ECS *ecs, entity_t entity_id) {
     C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
-    C_Transform *player_transform = ecs_get_component(ecs, ecs_find_entity_with_tag(ecs, "Player"), C_Transform);
+    C_Velocity *velocity = ecs_get_component(ecs, entity_id, C_Velocity);
+    C_EnemyAI *ai = ecs_get_component(ecs, entity_id, C_EnemyAI);
+    if (!ecs_is_alive(ecs, ai->target)) {
+        velocity->velocity = (Vector2){0, 0};
+        return;
+    }
+    C_Transform *player_transform = ecs_get_component(ecs, ai->target, C_Transform);
     Vector2 dir = Vector2Normalize(
     Vector2Subtract(player_transform->position, transform->position));
-    transform->velocity = Vector2Scale(dir, transform->speed);
+    velocity->velocity = Vector2Scale(dir, velocity->speed);
 }
 
+#ifndef HEADLESS
 void draw_entity_sys(ECS *ecs, entity_t entity_id) {
     C_Renderer *renderer = ecs_get_component(ecs, entity_id, C_Renderer);
     C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
+    Vector2 position = transform_interpolated(transform, ecs_get_resource(ecs, R_Time)->alpha);
 
     if (renderer->has_texture) {
-        DrawTextureV(renderer->texture, transform->position, renderer->color);
+        DrawTextureV(renderer->texture, position, renderer->color);
     } else {
-        if(renderer->shape_t==RECT) DrawRectangleV(transform->position, transform->size, renderer->color);
-        if(renderer->shape_t==CIRCLE) DrawCircleV(transform->position, (transform->size.x)/2, renderer->color);
+        if(renderer->shape_t==RECT) DrawRectangleV(position, transform->size, renderer->color);
+        if(renderer->shape_t==CIRCLE) DrawCircleV(position, (transform->size.x)/2, renderer->color);
     }
 }
 
 void draw_colliders_debug_sys(ECS *ecs, entity_t entity_id) {
     C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
     C_Collider *collider = ecs_get_component(ecs, entity_id, C_Collider);
+    Vector2 position = transform_interpolated(transform, ecs_get_resource(ecs, R_Time)->alpha);
     Color c = WHITE;
     if(collider->is_colliding) c=RED;
 
     switch(collider->collider_info.collider_t) {
-        case(COLLIDER_VERTICES):
-            for(size_t ind = 0;ind<collider->collider_info.vertices_info.n_of_vertices-1;ind++) {
-                Vector2 pos1 = Vector2Add(collider->collider_info.vertices_info.vertices[ind], transform->position);
-                Vector2 pos2 = Vector2Add(collider->collider_info.vertices_info.vertices[ind+1], transform->position);
+        case(COLLIDER_VERTICES): {
+            const Vector2 *vertices = vertex_pool_vertices(collider->collider_info.vertices_info.offset);
+            size_t n_of_vertices = collider->collider_info.vertices_info.n_of_vertices;
+            for(size_t ind = 0;ind<n_of_vertices;ind++) {
+                Vector2 pos1 = Vector2Add(vertices[ind], position);
+                Vector2 pos2 = Vector2Add(vertices[(ind+1)%n_of_vertices], position);
                 DrawLineV(pos1,pos2,c);
             }
-            Vector2 pos1 = Vector2Add(collider->collider_info.vertices_info.vertices[0], transform->position);
-            Vector2 pos2 = Vector2Add(collider->collider_info.vertices_info.vertices[collider->collider_info.vertices_info.n_of_vertices-1], transform->position);
-            DrawLineV(pos1,pos2, c);
             break;
+        }
         case(COLLIDER_CIRCLE):
-            Vector2 pos = Vector2Add(transform->position, collider->collider_info.circle_info.offset);
+            Vector2 pos = Vector2Add(position, collider->collider_info.circle_info.offset);
             float r = collider->collider_info.circle_info.radius;
             DrawRing(pos, r-2, r, 0, 360, 36, c);
             break;
+        case(COLLIDER_BOX):
+            Vector2 min = Vector2Add(position, collider->collider_info.box_info.offset);
+            DrawRectangleLinesEx((Rectangle){min.x, min.y, collider->collider_info.box_info.size.x, collider->collider_info.box_info.size.y}, 1.f, c);
+            break;
+        default:
+            break;
     }
 }
-
-Vector2 support_function_vertices(Vector2 position, Vector2 *vertices, size_t n_of_vertices, Vector2 dir) {
-    Vector2 v0 = Vector2Add(position, vertices[0]);
-    float dotmax = Vector2DotProduct(v0, dir);
-    Vector2 vmax = v0;
-    for(size_t ind=1;ind<n_of_vertices;ind++) {
-        Vector2 v = Vector2Add(vertices[ind], position);
-        float dot = Vector2DotProduct(v, dir);
-        if(dot>dotmax) {
-            vmax=v;
-            dotmax = dot;
-        }
+#endif
+
+// Updated every frame after movement, check_collisions_sys only runs GJK on colliders whose AABBs overlap
+#define BROADPHASE_TYPE BROADPHASE_TREE
+#define BROADPHASE_CELL_SIZE 32.f
+#define BROADPHASE_MARGIN 4.f
+
+void update_broadphase_sys(ECS *ecs, entity_t _) {
+    R_Physics *physics = ecs_get_resource(ecs, R_Physics);
+    Broadphase *broadphase = &physics->broadphase;
+    broadphase_begin(broadphase);
+    physics->largest_size = (Vector2){0, 0};
+    C_Collider *c_colliders = ecs_iter_components(ecs, C_Collider);
+    for (C_Collider *collider = vec_begin(c_colliders); collider < vec_end(c_colliders); collider++) {
+        entity_t entity_id = ecs_get_entity_id(ecs, C_Collider, collider);
+        C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
+        physics->largest_size = (Vector2){fmaxf(physics->largest_size.x, transform->size.x), fmaxf(physics->largest_size.y, transform->size.y)};
+        // Proxies are indexed by id, narrowphase_pair turns the pairs back into handles
+        broadphase_update(broadphase, ecs_entity_index(entity_id), collider_aabb(collider, transform->position), collider_filter(collider));
     }
-    return vmax;
+    broadphase_end(broadphase);
 }
 
-Vector2 support_function_circle(Vector2 center, float radius, Vector2 dir) {
-    return Vector2Add(center, Vector2Scale(dir,radius));
-}
-Vector2 support_function(Vector2 position, ColliderInfo collider_info, Vector2 dir) {
-    switch(collider_info.collider_t) {
-        case COLLIDER_VERTICES:
-            return support_function_vertices(position, collider_info.vertices_info.vertices, collider_info.vertices_info.n_of_vertices, dir);
-            break;
-        case COLLIDER_CIRCLE:
-            return support_function_circle(Vector2Add(position,collider_info.circle_info.offset), collider_info.circle_info.radius, dir);
-            break;
+// Contacts are keyed by handles, a reused index starts a new contact and the dead entity's one ends
+void narrowphase_pair(uint32_t index_a, uint32_t index_b, void *udata) {
+    ECS *ecs = udata;
+    entity_t entity_a = ecs_entity_at(ecs, index_a);
+    entity_t entity_b = ecs_entity_at(ecs, index_b);
+    ContactCache *contacts = &ecs_get_resource(ecs, R_Physics)->contacts;
+    Vector2 position_a = ecs_get_component(ecs, entity_a, C_Transform)->position;
+    Vector2 position_b = ecs_get_component(ecs, entity_b, C_Transform)->position;
+    Contact *contact = contact_cache_get(contacts, entity_a, entity_b);
+    // Neither side moved since the last solve, the result still holds
+    if(contact->solved && memcmp(&contact->position_a, &position_a, sizeof(Vector2))==0 && memcmp(&contact->position_b, &position_b, sizeof(Vector2))==0) {
+        contact_cache_report(contacts, contact, contact->touching);
+        return;
     }
+    C_Collider *collider_a = ecs_get_component(ecs, entity_a, C_Collider);
+    C_Collider *collider_b = ecs_get_component(ecs, entity_b, C_Collider);
+    bool touching = narrowphase_collide(position_a, &collider_a->collider_info, position_b, &collider_b->collider_info, &contact->dir, contact->simplex, &contact->penetration);
+    contact->solved = true;
+    contact->position_a = position_a;
+    contact->position_b = position_b;
+    contact_cache_report(contacts, contact, touching);
 }
 
-Vector2 get_epa_penetration_vec(C_Collider *collider, C_Transform *transform, C_Debug *_debug) {
-    Vector2 *simplex=NULL;
-    vec_init(simplex, 16);
-    vec_push(simplex, collider->simplex[0]);
-    vec_push(simplex, collider->simplex[1]);
-    vec_push(simplex, collider->simplex[2]);
-
-    // winding of simplex
-    float e0 = (simplex[1].x-simplex[0].x) * (simplex[1].y + simplex[0].y);
-    float e1 = (simplex[2].x - simplex[1].x) * (simplex[2].y + simplex[1].y);
-    float e2 = (simplex[0].x - simplex[2].x) * (simplex[0].y + simplex[2].y);
-    bool clockwise_winding = (e0 + e1 + e2 >= 0);
-
-    Vector2 penetration_vec = {0};
-    for(int it=0;it<32;it++) {
-        // Find closest edge to origin
-        size_t closest_ind =-1;
-        size_t closest_ind2 =-1;
-        float closest_dist;
-        Vector2 closest_normal;
-
-        Vector2 d_edge;
-
-        for(size_t i=0;i<vec_size(simplex);i++) {
-            size_t j = (i+1)%vec_size(simplex);
-
-            // calculate the edge
-            Vector2 edge = Vector2Subtract(simplex[i], simplex[j]);
-
-            // calculate the outward-facing normal of the edge
-            Vector2 edge_normal_out;
-            if(clockwise_winding) {
-                edge_normal_out=(Vector2){edge.y,-edge.x};
-            }else {
-                edge_normal_out=(Vector2){-edge.y,edge.x};
-            }
+// Pushes out of every touching collider, per axis the deepest one in each direction wins.
+// Summing them would push by the total depth when two enemies overlap the player from the same side.
+typedef struct {
+    Vector2 min;
+    Vector2 max;
+    bool touching;
+} PlayerPush;
 
-            edge_normal_out = Vector2Normalize(edge_normal_out);
+void resolve_player_collision(ECS *ecs, entity_t entity_id, Contact *contact, PlayerPush *push) {
+    C_Collider *collider = ecs_get_component(ecs, entity_id, C_Collider);
+    Penetration penetration = contact->penetration;
+    // The cached simplex is a-b, flip everything when the player is b
+    float sign = entity_id == contact->a ? 1.f : -1.f;
+    for(int ind=0;ind<3;ind++) {
+        collider->simplex[ind] = Vector2Scale(contact->simplex[ind], sign);
+    }
+    Vector2 pen_vec = Vector2Scale(penetration.normal, penetration.depth*sign);
+
+    C_Debug *debug = ecs_get_component(ecs, entity_id, C_Debug);
+    debug->start = penetration.point;
+    debug->end = pen_vec;
+    debug->pen_vec = pen_vec;
+    push->min = (Vector2){fminf(push->min.x, pen_vec.x), fminf(push->min.y, pen_vec.y)};
+    push->max = (Vector2){fmaxf(push->max.x, pen_vec.x), fmaxf(push->max.y, pen_vec.y)};
+    push->touching = true;
+}
 
-            // calculate how far away the edge is from the origin
-            float dist = Vector2DotProduct(edge_normal_out, simplex[i]);
-            
-            if(dist < closest_dist || closest_ind==-1) {
-                closest_dist = dist;
-                closest_normal = edge_normal_out;
-                closest_ind=j;
+bool is_player(ECS *ecs, entity_t entity_id) {
+    entity_t player = ecs_get_resource(ecs, R_Player)->entity;
+    return ecs_is_alive(ecs, player) && entity_id == player;
+}
 
-                d_edge = edge;
-            }
-        }
+// Every overlapping pair is solved once, results persist in contacts across frames
+void check_collisions_sys(ECS *ecs, entity_t _) {
+    C_Collider *c_colliders = ecs_iter_components(ecs, C_Collider);
+    for (C_Collider *collider = vec_begin(c_colliders); collider < vec_end(c_colliders); collider++) {
+        collider->is_colliding = false;
+    }
 
-        //_debug->pen_vec=closest_normal;
-        _debug->start=simplex[closest_ind];
-        _debug->end=d_edge;
+    R_Physics *physics = ecs_get_resource(ecs, R_Physics);
+    contact_cache_begin(&physics->contacts);
+    broadphase_pairs(&physics->broadphase, narrowphase_pair, ecs);
+    contact_cache_end(&physics->contacts);
 
-        Vector2 sup = support_function((Vector2){0,0}, collider->collider_info,closest_normal);
-        float dist = Vector2DotProduct(sup, closest_normal);
-        penetration_vec = Vector2Scale(closest_normal, dist);
+    PlayerPush push = {0};
+    for(ContactEvent *event=vec_begin(physics->contacts.events);event<vec_end(physics->contacts.events);event++) {
+        if(event->type == CONTACT_END) continue;
+        ecs_get_component(ecs, event->a, C_Collider)->is_colliding = true;
+        ecs_get_component(ecs, event->b, C_Collider)->is_colliding = true;
 
-        if(fabsf(dist-closest_dist)<=0.000001) {
-            return penetration_vec;
-        }else {
-            vec_push(simplex, simplex[closest_ind]);
-            simplex[closest_ind]=sup;
-        }
+        Contact *contact = contact_cache_find(&physics->contacts, event->a, event->b);
+        if(is_player(ecs, event->a)) resolve_player_collision(ecs, event->a, contact, &push);
+        if(is_player(ecs, event->b)) resolve_player_collision(ecs, event->b, contact, &push);
+    }
+    entity_t player = ecs_get_resource(ecs, R_Player)->entity;
+    if(push.touching && ecs_is_alive(ecs, player)) {
+        C_Transform *transform = ecs_get_component(ecs, player, C_Transform);
+        transform->position = Vector2Subtract(transform->position, Vector2Add(push.min, push.max));
     }
-    vec_free(simplex);
-    _debug->pen_vec=penetration_vec;
-    return penetration_vec;
 }
 
-bool check_gjk_collision(ECS *ecs, C_Collider *collider, C_Collider* collision) {
-    C_Transform *collider_transform = ecs_get_component(ecs, ecs_get_entity_id(ecs, C_Collider, collider), C_Transform);
-    C_Transform *collision_transform = ecs_get_component(ecs, ecs_get_entity_id(ecs, C_Collider, collision), C_Transform);
-
-    size_t simplex_vertices = 0;
-    Vector2 simplex[3] = {0};
-    Vector2 dir = Vector2Normalize((Vector2){1,1});
-
-    simplex[simplex_vertices] = Vector2Subtract(
-        support_function(collider_transform->position, collider->collider_info, dir),
-        support_function(collision_transform->position, collision->collider_info, Vector2Scale(dir,-1.f))
-    );
-    dir = Vector2Normalize(Vector2Scale(simplex[0],-1));
-
-    while(1) {
-        simplex[++simplex_vertices] = Vector2Subtract(
-            support_function(collider_transform->position, collider->collider_info, dir),
-            support_function(collision_transform->position, collision->collider_info, Vector2Scale(dir,-1.f))
-        );
-        if (Vector2DotProduct(simplex[simplex_vertices], dir) <= 0) {
-            return false;
-        }
+// Runs once per rendered frame rather than per tick so the target matches the interpolated sprites
+void camera_follow_sys(ECS *ecs, entity_t _) {
+    R_Camera *r_camera = ecs_get_resource(ecs, R_Camera);
+    if (!ecs_is_alive(ecs, r_camera->following)) return;
+    C_Transform *to_follow = ecs_get_component(ecs, r_camera->following, C_Transform);
+    r_camera->camera.target = transform_interpolated(to_follow, ecs_get_resource(ecs, R_Time)->alpha);
+}
 
-        // p1 - newest vertex
-        Vector2 p1_to_p2 = Vector2Subtract(simplex[simplex_vertices-1], simplex[simplex_vertices]);
-        Vector2 p1_to_origin = Vector2Scale(simplex[simplex_vertices], -1);
-        Vector3 p1_to_p2_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p2.x,p1_to_p2.y,0}, (Vector3){p1_to_origin.x,p1_to_origin.y,0}),(Vector3){p1_to_p2.x,p1_to_p2.y,0});
-        if(simplex_vertices<2) {
-            dir = Vector2Normalize((Vector2){p1_to_p2_perpendicular.x,p1_to_p2_perpendicular.y});
-            continue;
-        }
-        Vector2 p1_to_p3 = Vector2Subtract(simplex[0], simplex[simplex_vertices]);
-        p1_to_p2_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p3.x,p1_to_p3.y,0}, (Vector3){p1_to_p2.x,p1_to_p2.y,0}),(Vector3){p1_to_p2.x,p1_to_p2.y,0});
-        Vector3 p1_to_p3_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p2.x,p1_to_p2.y,0}, (Vector3){p1_to_p3.x,p1_to_p3.y,0}),(Vector3){p1_to_p3.x,p1_to_p3.y,0});
-
-        if(Vector3DotProduct((Vector3){p1_to_origin.x, p1_to_origin.y,0}, p1_to_p2_perpendicular)>=0) {
-            simplex[0]=simplex[1];
-            dir=Vector2Normalize((Vector2){p1_to_p2_perpendicular.x, p1_to_p2_perpendicular.y});
-        }else if(Vector3DotProduct((Vector3){p1_to_origin.x, p1_to_origin.y,0}, p1_to_p3_perpendicular)>=0) {
-            dir=Vector2Normalize((Vector2){p1_to_p3_perpendicular.x, p1_to_p3_perpendicular.y});
-        }else {
-            memcpy(collider->simplex,simplex, sizeof(simplex));
-            return true;
-        }
-        simplex[1]=simplex[2];
-        simplex_vertices--;
-    }
-    return false;
+// Inverse of the Camera2D transform, same as GetScreenToWorld2D but usable headless
+Vector2 screen_to_world(Camera2D camera, Vector2 screen) {
+    Vector2 view = Vector2Scale(Vector2Subtract(screen, camera.offset), 1.f/camera.zoom);
+    return Vector2Add(Vector2Rotate(view, -camera.rotation*DEG2RAD), camera.target);
 }
 
-void check_collisions_sys(ECS *ecs, entity_t entity_id) {
-    C_Collider *collider = ecs_get_component(ecs, entity_id, C_Collider);
-    C_Transform *transform = ecs_get_component(ecs, entity_id, C_Transform);
+typedef struct {
+    ECS *ecs;
+    Vector2 point;
+    entity_t hit;
+} MousePick;
+
+// Broadphase ids are bare indices and may belong to entities killed since the last update,
+// so only ids still carrying a transform whose rect holds the point count.
+// The highest index wins, the pick doesn't depend on the tree's layout.
+bool mouse_pick_hit(uint32_t id, void *udata) {
+    MousePick *pick = udata;
+    if (!(ecs_get_signature(pick->ecs, id) & ecs_get_component_signature(pick->ecs, C_Transform))) return true;
+    C_Transform *transform = ecs_get_component(pick->ecs, id, C_Transform);
+    if (!aabb_contains_point((AABB){transform->position, Vector2Add(transform->position, transform->size)}, pick->point)) return true;
+    if (pick->hit == ECS_NULL_ENTITY || id > ecs_entity_index(pick->hit)) pick->hit = ecs_entity_at(pick->ecs, id);
+    return true;
+}
 
-    collider->is_colliding =false;
-    C_Collider *c_colliders = ecs_iter_components(ecs, C_Collider);
-    for (C_Collider *collision = vec_begin(c_colliders); collision < vec_end(c_colliders); collision++) {
-        if (collider == collision) {
-            continue;
-        }
-        // Category Check
-        // GJK Check
-        if(check_gjk_collision(ecs, collider, collision)) {
-            collider->is_colliding = true;
-            //Vector2 pen_test = get_epa_penetration_vec(collider, transform);
-
-            sds tag = ecs_get_tag(ecs, entity_id);
-            if(tag) {
-                if(strcmp(tag, "Player")==0) {
-                    C_Debug *debug = ecs_get_component(ecs, entity_id, C_Debug);
-                    Vector2 pen_test = get_epa_penetration_vec(collider, transform, debug);
-                    //debug->pen_vec=pen_test;
-                    printf("%d %d\n", pen_test.x, pen_test.y);
-                    transform->position = Vector2Subtract(transform->position, pen_test);
-                }
-            }
-            break;
-        }
-    }
+// Picks against the drawn transform rect, not the collider, but candidates come from the broadphase:
+// entities without a collider can't be picked. A collider lies inside its transform rect, so growing
+// the query by the largest rect finds every entity whose rect holds the point.
+entity_t pick_entity(ECS *ecs, Vector2 point) {
+    R_Physics *physics = ecs_get_resource(ecs, R_Physics);
+    MousePick pick = {ecs, point, ECS_NULL_ENTITY};
+    AABB query = {Vector2Subtract(point, physics->largest_size), Vector2Add(point, physics->largest_size)};
+    broadphase_query(&physics->broadphase, query, (BroadphaseFilter){BROADPHASE_ALL_LAYERS, BROADPHASE_ALL_LAYERS}, mouse_pick_hit, &pick);
+    return pick.hit;
 }
 
-void camera_follow_sys(ECS *ecs, entity_t entity_id) {
-    C_Camera *c_camera = ecs_get_component(ecs, entity_id, C_Camera);
-    size_t ind = sds_vector_find(ecs->tags, sdsnew(c_camera->following_tag), 0);
-    C_Transform *to_follow = ecs_get_component(ecs, ecs_find_entity_with_tag(ecs, c_camera->following_tag), C_Transform);
-    c_camera->camera.target = to_follow->position;
+// Click to kill, picks against the camera at this tick's position of what it follows so replays pick the same entity
+void click_kill_sys(ECS *ecs, entity_t _) {
+    R_Input *input = ecs_get_resource(ecs, R_Input);
+    if (!input->click) return;
+    R_Camera *r_camera = ecs_get_resource(ecs, R_Camera);
+    Camera2D camera = r_camera->camera;
+    if (ecs_is_alive(ecs, r_camera->following)) camera.target = ecs_get_component(ecs, r_camera->following, C_Transform)->position;
+    entity_t selected_entity = pick_entity(ecs, screen_to_world(camera, input->mouse_position));
+    if (selected_entity != ECS_NULL_ENTITY) {
+        kill_entity(ecs, selected_entity);
+    }
 }
 
 void spawn_enemy_sys(ECS *ecs, entity_t _) {
-  if (IsKeyPressed(KEY_N)) {
+  if (ecs_get_resource(ecs, R_Input)->spawn) {
         entity_t entity_ind = new_entity_with_tag(ecs, "Enemy");
         C_Renderer e_renderer = {(Color){rand() % 255, rand() % 255, rand() % 255, 255}, (Texture){0},false, RECT};
         ecs_add_component(ecs, entity_ind, C_Renderer, e_renderer);
-        C_Transform e_transform = new_transform((Vector2){rand() % (GetScreenWidth()), rand() % GetScreenHeight()}, (Vector2){10, 10}, 200);
+        C_Transform e_transform = new_transform((Vector2){rand() % SCREEN_WIDTH, rand() % SCREEN_HEIGHT}, (Vector2){10, 10});
         ecs_add_component(ecs, entity_ind, C_Transform, e_transform);
-        ecs_add_component(ecs, entity_ind, C_Collider,new_collider_rect(0, 0, 10, 10, 0, 0));
+        ecs_add_component(ecs, entity_ind, C_Velocity, {200});
+        ecs_add_component(ecs, entity_ind, C_Collider,new_collider_rect(0, 0, 10, 10, LAYER_BIT(LAYER_ENEMY), BROADPHASE_ALL_LAYERS));
+        ecs_add_component(ecs, entity_ind, C_EnemyAI, {ecs_get_resource(ecs, R_Player)->entity});
     }
 }
 
-void erase_entities_sys(ECS *ecs, entity_t _) {
-    if (vec_size(ecs->entities_to_kill) > 0) {
-        for (entity_t *entity = vec_begin(ecs->entities_to_kill);
-            entity < vec_end(ecs->entities_to_kill); entity++) {
-            __ecs_erase_entity(ecs, *entity);
+// FNV-1a over every position, equal across a recording and its replay
+uint32_t transforms_checksum(ECS *ecs) {
+    uint32_t hash = 2166136261u;
+    C_Transform *c_transforms = ecs_iter_components(ecs, C_Transform);
+    for (C_Transform *transform = vec_begin(c_transforms); transform < vec_end(c_transforms); transform++) {
+        const uint8_t *bytes = (const uint8_t*)&transform->position;
+        for (size_t ind=0;ind<sizeof(Vector2);ind++) {
+            hash = (hash ^ bytes[ind]) * 16777619u;
         }
-        vec_erase(ecs->entities_to_kill, 0, vec_size(ecs->entities_to_kill));
     }
+    return hash;
 }
 
-int main(void) {
-    srand(time(0));
-    InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Game");
+#ifndef HEADLESS
+// Phase totals and every system under them, avg/max over the profile window and the average entity count
+void draw_profiler_overlay(ECS *ecs, int x, int y) {
+    char line[128];
+    enum system_type phases[] = {ON_PREUPDATE, ON_UPDATE, ON_DRAW};
+    for (size_t phase=0;phase<sizeof(phases)/sizeof(phases[0]);phase++) {
+        EcsTiming timing = ecs_phase_timing(ecs, phases[phase]);
+        snprintf(line, sizeof(line), "%-24s %6.3f %6.3f ms", timing.name, timing.avg_ms, timing.max_ms);
+        DrawText(line, x, y, 10, YELLOW);
+        y += 12;
+        for (size_t ind=0;ind<vec_size(ecs->systems[phases[phase]]);ind++) {
+            timing = ecs_system_timing(ecs, phases[phase], ind);
+            snprintf(line, sizeof(line), "  %-22s %6.3f %6.3f ms %6.0f", timing.name, timing.avg_ms, timing.max_ms, timing.avg_entities);
+            DrawText(line, x, y, 10, WHITE);
+            y += 12;
+        }
+    }
+}
 
-    // TODO: Resource Management
+void run_windowed(ECS *ecs, InputReplay *record) {
+    InputSource source = input_raylib_source(TICK_DT);
+    if (record) source = input_record_source(record, source);
+    input_set_source(source);
     Shader space_curvature_shd = LoadShader("resources/shaders/spacecurvature.fs", 0);
     int secondsLoc = GetShaderLocation(space_curvature_shd, "seconds");
-    Texture player_texture = LoadTexture("resources/player_ship.png");
-
     char id_display_buf[64] = "";
+
+    float seconds = 0.f;
+    float accumulator = 0.f;
+    bool show_profiler = false;
+    while (!WindowShouldClose()) {
+        // Overlay toggle is UI, not simulation input
+        if (IsKeyPressed(KEY_F3)) show_profiler = !show_profiler;
+        float frame_time = GetFrameTime();
+        seconds += frame_time;
+        SetShaderValue(space_curvature_shd, secondsLoc, &seconds, SHADER_UNIFORM_FLOAT);
+
+        input_raylib_poll();
+        accumulator += frame_time;
+        size_t ticks = 0;
+        while (accumulator >= TICK_DT && ticks < MAX_TICKS_PER_FRAME) {
+            input_begin_tick();
+            ecs_call_system(ecs, ON_PREUPDATE);
+            ecs_call_system(ecs, ON_UPDATE);
+            input_end_tick();
+            accumulator -= TICK_DT;
+            ticks++;
+        }
+        if (accumulator >= TICK_DT) accumulator = fmodf(accumulator, TICK_DT);
+        ecs_get_resource(ecs, R_Time)->alpha = accumulator / TICK_DT;
+
+        camera_follow_sys(ecs, ECS_NULL_ENTITY);
+        R_Camera *r_camera = ecs_get_resource(ecs, R_Camera);
+        // ID Display, killing by click happens in click_kill_sys
+        entity_t selected_entity = pick_entity(ecs, GetScreenToWorld2D(GetMousePosition(), r_camera->camera));
+
+        BeginDrawing();
+        ClearBackground(BLACK);
+        BeginMode2D(r_camera->camera);
+            ecs_call_system(ecs, ON_DRAW);
+
+            // DELETE  DEBUG
+            entity_t player_id = ecs_get_resource(ecs, R_Player)->entity;
+            if (ecs_is_alive(ecs, player_id)) {
+                C_Debug *player_debug = ecs_get_component(ecs, player_id, C_Debug);
+                C_Collider *player_collider= ecs_get_component(ecs, player_id, C_Collider);
+
+                DrawCircleV((Vector2){0,0}, 5.f, WHITE);
+                DrawLineV(player_collider->simplex[0], player_collider->simplex[1], PURPLE);
+                DrawLineV(player_collider->simplex[1], player_collider->simplex[2], PURPLE);
+                DrawLineV(player_collider->simplex[2], player_collider->simplex[0], PURPLE);
+
+                DrawLineV(player_debug->start, Vector2Add(player_debug->start,player_debug->end), GREEN);
+                DrawLineV((Vector2){0,0}, player_debug->pen_vec, DARKGREEN);
+            }
+
+        EndMode2D();
+
+        // BeginShaderMode(space_curvature_shd);
+        // EndShaderMode();
+
+        // ID Display
+        if (selected_entity != ECS_NULL_ENTITY) {
+            C_Transform *t = ecs_get_component(ecs, selected_entity, C_Transform);
+            sprintf(id_display_buf, "ID: %u, GEN: %u, X: %6.2f, Y: %6.2f", ecs_entity_index(selected_entity), ecs_entity_generation(selected_entity), t->position.x, t->position.y);
+        }
+        DrawText(id_display_buf, GetScreenWidth() - 300, 20, 16, WHITE);
+        if (show_profiler) draw_profiler_overlay(ecs, GetScreenWidth() - 300, 44);
+        EndDrawing();
+    }
+    CloseWindow();
+}
+#endif
+
+double seconds_between(struct timespec start, struct timespec end) {
+    return (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+}
+
+// ON_DRAW never runs, ticks go as fast as the CPU allows.
+// Without a replay it spawns one enemy per tick through the same key a player would press,
+// with one it runs until the log ends. The slowest tick is reported to find where a run fell off.
+void run_headless(ECS *ecs, size_t ticks, size_t enemies, InputReplay *record, InputReplay *replay) {
+    FixedInput fixed = {TICK_DT};
+    InputSource source = input_fixed_source(&fixed);
+    if (replay) {
+        source = input_replay_source(replay);
+        ticks = SIZE_MAX;
+    }
+    if (record) source = input_record_source(record, source);
+    input_set_source(source);
+
+    size_t tick = 0;
+    size_t slowest_tick = 0;
+    double slowest = 0.;
+    struct timespec start, end, tick_start, tick_end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(;tick<ticks;tick++) {
+        fixed.pressed[KEY_N] = tick < enemies;
+        if (!input_begin_tick()) break;
+        clock_gettime(CLOCK_MONOTONIC, &tick_start);
+        ecs_call_system(ecs, ON_PREUPDATE);
+        ecs_call_system(ecs, ON_UPDATE);
+        clock_gettime(CLOCK_MONOTONIC, &tick_end);
+        input_end_tick();
+        double tick_seconds = seconds_between(tick_start, tick_end);
+        if (tick_seconds > slowest) {
+            slowest = tick_seconds;
+            slowest_tick = tick;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = seconds_between(start, end);
+    printf("headless ticks=%zu entities=%d seconds=%.3f ticks_per_second=%.1f slowest_tick=%zu slowest_ms=%.3f checksum=%08x\n",
+        tick, ecs->number_of_entities, elapsed, tick/elapsed, slowest_tick, slowest*1e3, transforms_checksum(ecs));
+}
+
+int main(int argc, char **argv) {
+    // --headless [--ticks n] [--enemies n] [--record file] [--replay file] [--trace file], always headless when built with HEADLESS.
+    // --replay implies --headless and replaces the generated input, --trace dumps the last profile windows on exit
+#ifdef HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+    size_t ticks = 10000;
+    size_t enemies = 1000;
+    const char *record_path = NULL;
+    const char *replay_path = NULL;
+    const char *trace_path = NULL;
+    for(int arg=1;arg<argc;arg++) {
+        if(strcmp(argv[arg], "--headless")==0) headless = true;
+        else if(strcmp(argv[arg], "--ticks")==0 && arg+1<argc) ticks = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--enemies")==0 && arg+1<argc) enemies = strtoul(argv[++arg], NULL, 10);
+        else if(strcmp(argv[arg], "--record")==0 && arg+1<argc) record_path = argv[++arg];
+        else if(strcmp(argv[arg], "--replay")==0 && arg+1<argc) replay_path = argv[++arg];
+        else if(strcmp(argv[arg], "--trace")==0 && arg+1<argc) trace_path = argv[++arg];
+    }
+
+    uint32_t seed = time(0);
+    InputReplay replay, record;
+    if(replay_path) {
+        if(!input_replay_open(&replay, replay_path)) {
+            fprintf(stderr, "Can't read replay %s\n", replay_path);
+            return 1;
+        }
+        seed = replay.seed;
+        headless = true;
+    }
+    if(record_path && !input_record_open(&record, record_path, seed)) {
+        fprintf(stderr, "Can't write replay %s\n", record_path);
+        return 1;
+    }
+    srand(seed);
+    Texture player_texture = {0};
+#ifndef HEADLESS
+    if(!headless) {
+        // Frame rate is left to vsync, the simulation keeps its own rate
+        SetConfigFlags(FLAG_VSYNC_HINT);
+        InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Game");
+        // TODO: Resource Management
+        player_texture = LoadTexture("resources/player_ship.png");
+    }
+#endif
+
     ECS *ecs = init_ecs();
     ecs_register_component(ecs, C_Transform);
     ecs_register_component(ecs, C_Renderer);
     ecs_register_component(ecs, C_Collider);
-    ecs_register_component(ecs, C_Camera);
     ecs_register_component(ecs, C_Debug);
+    ecs_register_component(ecs, C_EnemyAI);
+    ecs_register_component(ecs, C_Velocity);
+    ecs_register_resource(ecs, R_Time, {TICK_DT, 1.f});
+    ecs_register_resource(ecs, R_Physics, {0});
+    R_Physics *physics = ecs_get_resource(ecs, R_Physics);
+    broadphase_init(&physics->broadphase, BROADPHASE_TYPE, BROADPHASE_CELL_SIZE, BROADPHASE_MARGIN);
+    // Swarms only collide with the player and the world
+    broadphase_set_layer_pair(&physics->broadphase, LAYER_ENEMY, LAYER_ENEMY, false);
+    broadphase_set_layer_pair(&physics->broadphase, LAYER_WORLD, LAYER_WORLD, false);
+    contact_cache_init(&physics->contacts);
+    ecs_register_resource(ecs, R_Input, {0});
 
     // Player Definition
     entity_t player_id = new_entity_with_tag(ecs, "Player");
-    C_Transform player_transform = new_transform((Vector2){20, 20}, (Vector2){60, 60}, 300.f);
+    C_Transform player_transform = new_transform((Vector2){20, 20}, (Vector2){60, 60});
     ecs_add_component(ecs, player_id, C_Transform, player_transform);
+    ecs_add_component(ecs, player_id, C_Velocity, {300.f});
     ecs_add_component(ecs, player_id, C_Renderer, {WHITE, player_texture, true, RECT});
-    //ecs_add_component(ecs, player_id, C_Collider, new_collider_circle(15.f, 15.f, 20.f, 0, 0));
-    ecs_add_component(ecs, player_id, C_Collider, new_collider_rect(0, 0, 30, 30, 0,0));
+    //ecs_add_component(ecs, player_id, C_Collider, new_collider_circle(15.f, 15.f, 20.f, LAYER_BIT(LAYER_PLAYER), BROADPHASE_ALL_LAYERS));
+    ecs_add_component(ecs, player_id, C_Collider, new_collider_rect(0, 0, 30, 30, LAYER_BIT(LAYER_PLAYER), BROADPHASE_ALL_LAYERS));
     ecs_add_component(ecs, player_id, C_Debug, {(Vector2){0}});
+    ecs_register_resource(ecs, R_Player, {player_id});
     // End Of Player Definition
     
     entity_t static_e = new_entity(ecs);
-    C_Transform static_t = new_transform((Vector2){120, 20}, (Vector2){100, 100}, 0.f);
+    C_Transform static_t = new_transform((Vector2){120, 20}, (Vector2){100, 100});
     ecs_add_component(ecs, static_e, C_Transform, static_t);
     ecs_add_component(ecs, static_e, C_Renderer, {RED, (Texture){0}, false, RECT});
-    ecs_add_component(ecs, static_e, C_Collider, new_collider_rect(0, 0, 100, 100, 0, 0));
+    ecs_add_component(ecs, static_e, C_Collider, new_collider_rect(0, 0, 100, 100, LAYER_BIT(LAYER_WORLD), BROADPHASE_ALL_LAYERS));
 
-    entity_t camera_id = new_entity_with_tag(ecs, "Main Camera");
     Camera2D camera = {
-        (Vector2){(GetScreenWidth() / 2.f) - player_transform.size.x / 2, 
-        GetScreenHeight() / 2.f - player_transform.size.y / 2},
+        (Vector2){(SCREEN_WIDTH / 2.f) - player_transform.size.x / 2, 
+        SCREEN_HEIGHT / 2.f - player_transform.size.y / 2},
         (Vector2){0, 0}, 0.f, 1.f
     };
-    ecs_add_component(ecs, camera_id, C_Camera, {camera, "Player"});
+    ecs_register_resource(ecs, R_Camera, {camera, player_id});
 
-    ecs_register_system(ecs, ON_PREUPDATE, erase_entities_sys);
-    ecs_register_component_system(ecs, ON_UPDATE, apply_velocity_sys, C_Transform);
-    ecs_register_component_system(ecs, ON_UPDATE, check_collisions_sys, C_Transform, C_Collider);
-    ecs_register_component_system(ecs, ON_UPDATE, camera_follow_sys, C_Camera);
+    ecs_register_system(ecs, ON_PREUPDATE, read_input_sys);
+    ecs_register_batch_system(ecs, ON_PREUPDATE, snapshot_transforms_sys, C_Transform);
+    ecs_register_batch_system(ecs, ON_UPDATE, apply_velocity_sys, C_Transform, C_Velocity);
+    ecs_register_system(ecs, ON_UPDATE, update_broadphase_sys);
+    ecs_register_system(ecs, ON_UPDATE, check_collisions_sys);
     ecs_register_tag_system(ecs, ON_UPDATE, player_movement_sys, "Player");
-    ecs_register_tag_system(ecs, ON_UPDATE, enemy_ai_sys, "Enemy");
+    ecs_register_parallel_system(ecs, ON_UPDATE, enemy_ai_sys, C_Transform, C_Velocity, C_EnemyAI);
     ecs_register_system(ecs, ON_UPDATE, spawn_enemy_sys);
+    ecs_register_system(ecs, ON_UPDATE, click_kill_sys);
+#ifndef HEADLESS
     ecs_register_component_system(ecs, ON_DRAW, draw_entity_sys, C_Renderer, C_Transform);
     ecs_register_component_system(ecs, ON_DRAW, draw_colliders_debug_sys,C_Transform, C_Collider); 
-
-    float seconds = 0.f;
-    SetTargetFPS(60);
-    while (!WindowShouldClose()) {
-        seconds += GetFrameTime();
-        SetShaderValue(space_curvature_shd, secondsLoc, &seconds, SHADER_UNIFORM_FLOAT);
-
-        ecs_call_system(ecs, ON_PREUPDATE);
-        ecs_call_system(ecs, ON_UPDATE);
-
-        C_Camera *c_camera = ecs_get_component(ecs, ecs_find_entity_with_tag(ecs, "Main Camera"), C_Camera);
-        // ID Display + Entity by Click Kill
-        C_Transform *c_transforms = ecs_iter_components(ecs, C_Transform);
-        Vector2 mousePos = GetScreenToWorld2D(GetMousePosition(), c_camera->camera);
-        size_t selected_entity = -1;
-        for (C_Transform *transform = vec_begin(c_transforms);
-            transform < vec_end(c_transforms); transform++) {
-            if (CheckCollisionPointRec(mousePos, (Rectangle){transform->position.x, transform->position.y, transform->size.x, transform->size.y})) {
-                selected_entity = ecs_get_entity_id(ecs, C_Transform, transform);
-            }
-        }
-        if (IsMouseButtonPressed(0) && selected_entity != -1) {
-            kill_entity(ecs, selected_entity);
-        }
-
-        BeginDrawing();
-        ClearBackground(BLACK);
-        BeginMode2D(c_camera->camera);
-            ecs_call_system(ecs, ON_DRAW);
-
-            // DELETE  DEBUG
-            entity_t player_id = ecs_find_entity_with_tag(ecs, "Player");
-            C_Debug *player_debug = ecs_get_component(ecs, player_id, C_Debug);
-            C_Transform *player_transform= ecs_get_component(ecs, player_id, C_Transform);
-            C_Collider *player_collider= ecs_get_component(ecs, player_id, C_Collider);
-
-            DrawCircleV((Vector2){0,0}, 5.f, WHITE);
-            DrawLineV(player_collider->simplex[0], player_collider->simplex[1], PURPLE);
-            DrawLineV(player_collider->simplex[1], player_collider->simplex[2], PURPLE);
-            DrawLineV(player_collider->simplex[2], player_collider->simplex[0], PURPLE);
-
-            DrawLineV(player_debug->start, Vector2Add(player_debug->start,player_debug->end), GREEN);
-            Vector2 mid =Vector2Add(player_debug->start,Vector2Scale(player_debug->end,0.5f));
-            DrawLineV((Vector2){0,0}, player_debug->pen_vec, DARKGREEN);
-
-        EndMode2D();
-
-        // BeginShaderMode(space_curvature_shd);
-        // EndShaderMode();
-
-        // ID Display
-        if (selected_entity != -1) {
-            C_Transform *t = ecs_get_component(ecs, selected_entity, C_Transform);
-            sprintf(id_display_buf, "ID: %d, GEN: 0, X: %6.2f, Y: %6.2f", selected_entity, t->position.x, t->position.y);
-        }
-        DrawText(id_display_buf, GetScreenWidth() - 300, 20, 16, WHITE);
-        EndDrawing();
-    }
+#endif
+
+    // Systems without declared access (input, spawning, click to kill) keep running alone
+    // Steering only writes C_Velocity, so player_movement_sys overlaps the broadphase and collision systems
+    ecs_set_system_access(ecs, ON_UPDATE, apply_velocity_sys, ecs_components_mask(ecs, C_Velocity), ecs_components_mask(ecs, C_Transform));
+    ecs_set_system_access(ecs, ON_UPDATE, update_broadphase_sys, ecs_components_mask(ecs, C_Transform, C_Collider), 0);
+    ecs_set_system_access(ecs, ON_UPDATE, check_collisions_sys, 0, ecs_components_mask(ecs, C_Transform, C_Collider, C_Debug));
+    ecs_set_system_access(ecs, ON_UPDATE, player_movement_sys, 0, ecs_components_mask(ecs, C_Velocity));
+    ecs_set_system_access(ecs, ON_UPDATE, enemy_ai_sys, ecs_components_mask(ecs, C_Transform, C_EnemyAI), ecs_components_mask(ecs, C_Velocity));
+    ecs_set_system_resource_access(ecs, ON_UPDATE, apply_velocity_sys, ecs_resources_mask(ecs, R_Time), 0);
+    ecs_set_system_resource_access(ecs, ON_UPDATE, update_broadphase_sys, 0, ecs_resources_mask(ecs, R_Physics));
+    ecs_set_system_resource_access(ecs, ON_UPDATE, check_collisions_sys, ecs_resources_mask(ecs, R_Player), ecs_resources_mask(ecs, R_Physics));
+    ecs_set_system_resource_access(ecs, ON_UPDATE, player_movement_sys, ecs_resources_mask(ecs, R_Input), 0);
+    ecs_set_thread_count(ecs, jobs_hardware_threads());
+    ecs_set_profiling(ecs, true);
+    ecs_set_parallel_phase(ecs, ON_UPDATE, true);
+
+#ifndef HEADLESS
+    if(!headless) run_windowed(ecs, record_path ? &record : NULL);
+#endif
+    if(headless) run_headless(ecs, ticks, enemies, record_path ? &record : NULL, replay_path ? &replay : NULL);
+    if(trace_path && !ecs_dump_trace(ecs, trace_path)) fprintf(stderr, "Can't write trace %s\n", trace_path);
+    if(record_path) input_replay_close(&record);
+    if(replay_path) input_replay_close(&replay);
+
+    broadphase_free(&physics->broadphase);
+    contact_cache_free(&physics->contacts);
     free_ecs(ecs);
-    CloseWindow();
+    vertex_pool_free();
+    intern_pool_free();
     return 0;
 }
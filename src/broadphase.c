@@ -0,0 +1,567 @@
+#include <math.h>
+#include "../include/vector.h"
+#include "../include/broadphase.h"
+
+// Spatial Hash
+static inline int32_t cell_coord(SpatialHash *hash, float x) {
+    return (int32_t)floorf(x / hash->cell_size);
+}
+
+static inline size_t cell_hash(int32_t cx, int32_t cy) {
+    return (size_t)((uint32_t)cx*73856093u ^ (uint32_t)cy*19349663u);
+}
+
+static int entry_compare(const void *a, const void *b) {
+    const SpatialHashEntry *ea = a;
+    const SpatialHashEntry *eb = b;
+    if(ea->cx != eb->cx) return ea->cx < eb->cx ? -1 : 1;
+    if(ea->cy != eb->cy) return ea->cy < eb->cy ? -1 : 1;
+    return (ea->proxy > eb->proxy) - (ea->proxy < eb->proxy);
+}
+
+static SpatialHashCell *find_cell(SpatialHash *hash, int32_t cx, int32_t cy) {
+    size_t mask = hash->cells_capacity-1;
+    for(size_t slot=cell_hash(cx, cy)&mask;;slot=(slot+1)&mask) {
+        SpatialHashCell *cell = &hash->cells[slot];
+        if(cell->count == 0) return NULL;
+        if(cell->cx == cx && cell->cy == cy) return cell;
+    }
+}
+
+void spatial_hash_init(SpatialHash *hash, float cell_size) {
+    hash->cell_size = cell_size;
+    hash->proxies = NULL;
+    vec_init(hash->proxies, 256);
+    hash->entries = NULL;
+    vec_init(hash->entries, 1024);
+    hash->cells_capacity = 1024;
+    hash->cells = calloc(hash->cells_capacity, sizeof(SpatialHashCell));
+}
+
+void spatial_hash_free(SpatialHash *hash) {
+    vec_free(hash->proxies);
+    vec_free(hash->entries);
+    free(hash->cells);
+}
+
+void spatial_hash_clear(SpatialHash *hash) {
+    vec_get_base(hash->proxies)->size = 0;
+    vec_get_base(hash->entries)->size = 0;
+}
+
+void spatial_hash_insert(SpatialHash *hash, uint32_t id, AABB aabb, BroadphaseFilter filter) {
+    BroadphaseProxy proxy = {id, aabb, filter};
+    vec_push(hash->proxies, proxy);
+}
+
+void spatial_hash_build(SpatialHash *hash) {
+    vec_get_base(hash->entries)->size = 0;
+    for(size_t ind=0;ind<vec_size(hash->proxies);ind++) {
+        AABB aabb = hash->proxies[ind].aabb;
+        for(int32_t cx=cell_coord(hash, aabb.min.x);cx<=cell_coord(hash, aabb.max.x);cx++) {
+            for(int32_t cy=cell_coord(hash, aabb.min.y);cy<=cell_coord(hash, aabb.max.y);cy++) {
+                SpatialHashEntry entry = {cx, cy, ind};
+                vec_push(hash->entries, entry);
+            }
+        }
+    }
+    qsort(hash->entries, vec_size(hash->entries), sizeof(SpatialHashEntry), entry_compare);
+
+    // Keep the table at most half full
+    size_t capacity = hash->cells_capacity;
+    while(capacity < vec_size(hash->entries)*2) capacity *= 2;
+    if(capacity != hash->cells_capacity) {
+        free(hash->cells);
+        hash->cells = calloc(capacity, sizeof(SpatialHashCell));
+        hash->cells_capacity = capacity;
+    }else {
+        memset(hash->cells, 0, sizeof(SpatialHashCell)*capacity);
+    }
+
+    size_t mask = hash->cells_capacity-1;
+    for(size_t start=0;start<vec_size(hash->entries);) {
+        SpatialHashEntry *entry = &hash->entries[start];
+        size_t end = start+1;
+        while(end<vec_size(hash->entries) && hash->entries[end].cx == entry->cx && hash->entries[end].cy == entry->cy) end++;
+
+        size_t slot = cell_hash(entry->cx, entry->cy)&mask;
+        while(hash->cells[slot].count != 0) slot = (slot+1)&mask;
+        hash->cells[slot] = (SpatialHashCell){entry->cx, entry->cy, start, end-start};
+        start = end;
+    }
+}
+
+void spatial_hash_query(SpatialHash *hash, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    for(int32_t cx=cell_coord(hash, aabb.min.x);cx<=cell_coord(hash, aabb.max.x);cx++) {
+        for(int32_t cy=cell_coord(hash, aabb.min.y);cy<=cell_coord(hash, aabb.max.y);cy++) {
+            SpatialHashCell *cell = find_cell(hash, cx, cy);
+            if(cell == NULL) continue;
+            for(size_t ind=cell->start;ind<cell->start+cell->count;ind++) {
+                BroadphaseProxy *proxy = &hash->proxies[hash->entries[ind].proxy];
+                if(!broadphase_filter_pass(proxy->filter, filter)) continue;
+                if(!aabb_overlap(proxy->aabb, aabb)) continue;
+                // A proxy spanning several cells is only reported from the cell holding the overlap's min corner
+                if(cell_coord(hash, fmaxf(proxy->aabb.min.x, aabb.min.x)) != cx) continue;
+                if(cell_coord(hash, fmaxf(proxy->aabb.min.y, aabb.min.y)) != cy) continue;
+                if(!callback(proxy->id, udata)) return;
+            }
+        }
+    }
+}
+
+void spatial_hash_raycast(SpatialHash *hash, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    AABB bounds = {{fminf(from.x, to.x), fminf(from.y, to.y)}, {fmaxf(from.x, to.x), fmaxf(from.y, to.y)}};
+    for(int32_t cx=cell_coord(hash, bounds.min.x);cx<=cell_coord(hash, bounds.max.x);cx++) {
+        for(int32_t cy=cell_coord(hash, bounds.min.y);cy<=cell_coord(hash, bounds.max.y);cy++) {
+            SpatialHashCell *cell = find_cell(hash, cx, cy);
+            if(cell == NULL) continue;
+            for(size_t ind=cell->start;ind<cell->start+cell->count;ind++) {
+                BroadphaseProxy *proxy = &hash->proxies[hash->entries[ind].proxy];
+                if(!broadphase_filter_pass(proxy->filter, filter)) continue;
+                if(!aabb_overlap(proxy->aabb, bounds)) continue;
+                if(cell_coord(hash, fmaxf(proxy->aabb.min.x, bounds.min.x)) != cx) continue;
+                if(cell_coord(hash, fmaxf(proxy->aabb.min.y, bounds.min.y)) != cy) continue;
+                if(!aabb_segment_overlap(proxy->aabb, from, to)) continue;
+                if(!callback(proxy->id, udata)) return;
+            }
+        }
+    }
+}
+
+bool aabb_segment_overlap(AABB a, Vector2 from, Vector2 to) {
+    float t_min = 0.f;
+    float t_max = 1.f;
+    float origin[2] = {from.x, from.y};
+    float delta[2] = {to.x-from.x, to.y-from.y};
+    float min[2] = {a.min.x, a.min.y};
+    float max[2] = {a.max.x, a.max.y};
+    for(int axis=0;axis<2;axis++) {
+        if(fabsf(delta[axis]) < 1e-9f) {
+            if(origin[axis] < min[axis] || origin[axis] > max[axis]) return false;
+            continue;
+        }
+        float t1 = (min[axis]-origin[axis]) / delta[axis];
+        float t2 = (max[axis]-origin[axis]) / delta[axis];
+        if(t1 > t2) {
+            float tmp = t1;
+            t1 = t2;
+            t2 = tmp;
+        }
+        t_min = fmaxf(t_min, t1);
+        t_max = fminf(t_max, t2);
+        if(t_min > t_max) return false;
+    }
+    return true;
+}
+
+// AABB Tree
+// Traversal stacks start on the C stack and move to the heap if a tree gets deeper
+#define AABB_TREE_STACK_SIZE 256
+#define is_leaf(node) ((node)->child1 == AABB_TREE_NULL)
+
+static int32_t allocate_node(AABBTree *tree) {
+    int32_t node_ind;
+    if(tree->free_list == AABB_TREE_NULL) {
+        AABBTreeNode node = {0};
+        vec_push(tree->nodes, node);
+        node_ind = vec_size(tree->nodes)-1;
+    }else {
+        node_ind = tree->free_list;
+        tree->free_list = tree->nodes[node_ind].parent;
+    }
+    AABBTreeNode *node = &tree->nodes[node_ind];
+    node->parent = AABB_TREE_NULL;
+    node->child1 = AABB_TREE_NULL;
+    node->child2 = AABB_TREE_NULL;
+    node->height = 0;
+    return node_ind;
+}
+
+static void free_node(AABBTree *tree, int32_t node_ind) {
+    tree->nodes[node_ind].parent = tree->free_list;
+    tree->nodes[node_ind].height = -1;
+    tree->free_list = node_ind;
+}
+
+// Rotates the taller grandchild up if node_ind's children heights differ by more than one, returns the new subtree root
+static int32_t balance(AABBTree *tree, int32_t ia) {
+    AABBTreeNode *a = &tree->nodes[ia];
+    if(is_leaf(a) || a->height < 2) return ia;
+
+    int32_t ib = a->child1;
+    int32_t ic = a->child2;
+    AABBTreeNode *b = &tree->nodes[ib];
+    AABBTreeNode *c = &tree->nodes[ic];
+    int32_t node_balance = c->height - b->height;
+
+    if(node_balance > 1) {
+        int32_t i_f = c->child1;
+        int32_t ig = c->child2;
+        AABBTreeNode *f = &tree->nodes[i_f];
+        AABBTreeNode *g = &tree->nodes[ig];
+
+        c->child1 = ia;
+        c->parent = a->parent;
+        a->parent = ic;
+        if(c->parent != AABB_TREE_NULL) {
+            if(tree->nodes[c->parent].child1 == ia) tree->nodes[c->parent].child1 = ic;
+            else tree->nodes[c->parent].child2 = ic;
+        }else {
+            tree->root = ic;
+        }
+
+        if(f->height > g->height) {
+            c->child2 = i_f;
+            a->child2 = ig;
+            g->parent = ia;
+            a->aabb = aabb_union(b->aabb, g->aabb);
+            c->aabb = aabb_union(a->aabb, f->aabb);
+            a->height = 1 + (b->height > g->height ? b->height : g->height);
+            c->height = 1 + (a->height > f->height ? a->height : f->height);
+        }else {
+            c->child2 = ig;
+            a->child2 = i_f;
+            f->parent = ia;
+            a->aabb = aabb_union(b->aabb, f->aabb);
+            c->aabb = aabb_union(a->aabb, g->aabb);
+            a->height = 1 + (b->height > f->height ? b->height : f->height);
+            c->height = 1 + (a->height > g->height ? a->height : g->height);
+        }
+        return ic;
+    }
+
+    if(node_balance < -1) {
+        int32_t id = b->child1;
+        int32_t ie = b->child2;
+        AABBTreeNode *d = &tree->nodes[id];
+        AABBTreeNode *e = &tree->nodes[ie];
+
+        b->child1 = ia;
+        b->parent = a->parent;
+        a->parent = ib;
+        if(b->parent != AABB_TREE_NULL) {
+            if(tree->nodes[b->parent].child1 == ia) tree->nodes[b->parent].child1 = ib;
+            else tree->nodes[b->parent].child2 = ib;
+        }else {
+            tree->root = ib;
+        }
+
+        if(d->height > e->height) {
+            b->child2 = id;
+            a->child1 = ie;
+            e->parent = ia;
+            a->aabb = aabb_union(c->aabb, e->aabb);
+            b->aabb = aabb_union(a->aabb, d->aabb);
+            a->height = 1 + (c->height > e->height ? c->height : e->height);
+            b->height = 1 + (a->height > d->height ? a->height : d->height);
+        }else {
+            b->child2 = ie;
+            a->child1 = id;
+            d->parent = ia;
+            a->aabb = aabb_union(c->aabb, d->aabb);
+            b->aabb = aabb_union(a->aabb, e->aabb);
+            a->height = 1 + (c->height > d->height ? c->height : d->height);
+            b->height = 1 + (a->height > e->height ? a->height : e->height);
+        }
+        return ib;
+    }
+    return ia;
+}
+
+// Refits and rebalances every ancestor of node_ind
+static void fix_upwards(AABBTree *tree, int32_t node_ind) {
+    while(node_ind != AABB_TREE_NULL) {
+        node_ind = balance(tree, node_ind);
+        AABBTreeNode *node = &tree->nodes[node_ind];
+        AABBTreeNode *child1 = &tree->nodes[node->child1];
+        AABBTreeNode *child2 = &tree->nodes[node->child2];
+        node->height = 1 + (child1->height > child2->height ? child1->height : child2->height);
+        node->aabb = aabb_union(child1->aabb, child2->aabb);
+        node_ind = node->parent;
+    }
+}
+
+// Walks down to the sibling that increases the total perimeter the least
+static void insert_leaf(AABBTree *tree, int32_t leaf) {
+    if(tree->root == AABB_TREE_NULL) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = AABB_TREE_NULL;
+        return;
+    }
+
+    AABB leaf_aabb = tree->nodes[leaf].aabb;
+    int32_t index = tree->root;
+    while(!is_leaf(&tree->nodes[index])) {
+        AABBTreeNode *node = &tree->nodes[index];
+        float area = aabb_perimeter(node->aabb);
+        float combined_area = aabb_perimeter(aabb_union(node->aabb, leaf_aabb));
+        // Cost of making a new parent for this node and the leaf
+        float cost = 2.f*combined_area;
+        // Minimum cost of pushing the leaf further down
+        float inheritance_cost = 2.f*(combined_area - area);
+
+        float child_costs[2];
+        int32_t children[2] = {node->child1, node->child2};
+        for(int ind=0;ind<2;ind++) {
+            AABBTreeNode *child = &tree->nodes[children[ind]];
+            float union_area = aabb_perimeter(aabb_union(leaf_aabb, child->aabb));
+            child_costs[ind] = (is_leaf(child) ? union_area : union_area - aabb_perimeter(child->aabb)) + inheritance_cost;
+        }
+        if(cost < child_costs[0] && cost < child_costs[1]) break;
+        index = child_costs[0] < child_costs[1] ? children[0] : children[1];
+    }
+
+    int32_t sibling = index;
+    int32_t old_parent = tree->nodes[sibling].parent;
+    int32_t new_parent = allocate_node(tree);
+    tree->nodes[new_parent].parent = old_parent;
+    tree->nodes[new_parent].aabb = aabb_union(leaf_aabb, tree->nodes[sibling].aabb);
+    tree->nodes[new_parent].height = tree->nodes[sibling].height+1;
+    tree->nodes[new_parent].child1 = sibling;
+    tree->nodes[new_parent].child2 = leaf;
+    if(old_parent != AABB_TREE_NULL) {
+        if(tree->nodes[old_parent].child1 == sibling) tree->nodes[old_parent].child1 = new_parent;
+        else tree->nodes[old_parent].child2 = new_parent;
+    }else {
+        tree->root = new_parent;
+    }
+    tree->nodes[sibling].parent = new_parent;
+    tree->nodes[leaf].parent = new_parent;
+
+    fix_upwards(tree, new_parent);
+}
+
+static void remove_leaf(AABBTree *tree, int32_t leaf) {
+    if(leaf == tree->root) {
+        tree->root = AABB_TREE_NULL;
+        return;
+    }
+    int32_t parent = tree->nodes[leaf].parent;
+    int32_t grand_parent = tree->nodes[parent].parent;
+    int32_t sibling = tree->nodes[parent].child1 == leaf ? tree->nodes[parent].child2 : tree->nodes[parent].child1;
+
+    if(grand_parent != AABB_TREE_NULL) {
+        if(tree->nodes[grand_parent].child1 == parent) tree->nodes[grand_parent].child1 = sibling;
+        else tree->nodes[grand_parent].child2 = sibling;
+        tree->nodes[sibling].parent = grand_parent;
+        free_node(tree, parent);
+        fix_upwards(tree, grand_parent);
+    }else {
+        tree->root = sibling;
+        tree->nodes[sibling].parent = AABB_TREE_NULL;
+        free_node(tree, parent);
+    }
+}
+
+static AABB fatten(AABBTree *tree, AABB aabb) {
+    return (AABB){{aabb.min.x-tree->margin, aabb.min.y-tree->margin}, {aabb.max.x+tree->margin, aabb.max.y+tree->margin}};
+}
+
+void aabb_tree_init(AABBTree *tree, float margin) {
+    tree->nodes = NULL;
+    vec_init(tree->nodes, 256);
+    tree->root = AABB_TREE_NULL;
+    tree->free_list = AABB_TREE_NULL;
+    tree->margin = margin;
+}
+
+void aabb_tree_free(AABBTree *tree) {
+    vec_free(tree->nodes);
+}
+
+int32_t aabb_tree_create_proxy(AABBTree *tree, uint32_t id, AABB aabb, BroadphaseFilter filter) {
+    int32_t proxy = allocate_node(tree);
+    tree->nodes[proxy].aabb = fatten(tree, aabb);
+    tree->nodes[proxy].tight = aabb;
+    tree->nodes[proxy].id = id;
+    tree->nodes[proxy].filter = filter;
+    insert_leaf(tree, proxy);
+    return proxy;
+}
+
+void aabb_tree_destroy_proxy(AABBTree *tree, int32_t proxy) {
+    remove_leaf(tree, proxy);
+    free_node(tree, proxy);
+}
+
+bool aabb_tree_move_proxy(AABBTree *tree, int32_t proxy, AABB aabb) {
+    tree->nodes[proxy].tight = aabb;
+    if(aabb_contains(tree->nodes[proxy].aabb, aabb)) return false;
+    remove_leaf(tree, proxy);
+    tree->nodes[proxy].aabb = fatten(tree, aabb);
+    insert_leaf(tree, proxy);
+    return true;
+}
+
+static int32_t *grow_stack(int32_t *stack, const int32_t *local, size_t *capacity, size_t stack_size) {
+    int32_t *grown = malloc(sizeof(int32_t)*(*capacity)*2);
+    memcpy(grown, stack, sizeof(int32_t)*stack_size);
+    if(stack != local) free(stack);
+    *capacity *= 2;
+    return grown;
+}
+
+void aabb_tree_query(AABBTree *tree, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    int32_t local[AABB_TREE_STACK_SIZE];
+    int32_t *stack = local;
+    size_t capacity = AABB_TREE_STACK_SIZE;
+    size_t stack_size = 0;
+    if(tree->root != AABB_TREE_NULL) stack[stack_size++] = tree->root;
+    while(stack_size > 0) {
+        AABBTreeNode *node = &tree->nodes[stack[--stack_size]];
+        if(!aabb_overlap(node->aabb, aabb)) continue;
+        if(is_leaf(node)) {
+            if(!aabb_overlap(node->tight, aabb) || !broadphase_filter_pass(node->filter, filter)) continue;
+            if(!callback(node->id, udata)) break;
+        }else {
+            if(stack_size+2 > capacity) stack = grow_stack(stack, local, &capacity, stack_size);
+            stack[stack_size++] = node->child1;
+            stack[stack_size++] = node->child2;
+        }
+    }
+    if(stack != local) free(stack);
+}
+
+void aabb_tree_raycast(AABBTree *tree, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    int32_t local[AABB_TREE_STACK_SIZE];
+    int32_t *stack = local;
+    size_t capacity = AABB_TREE_STACK_SIZE;
+    size_t stack_size = 0;
+    if(tree->root != AABB_TREE_NULL) stack[stack_size++] = tree->root;
+    while(stack_size > 0) {
+        AABBTreeNode *node = &tree->nodes[stack[--stack_size]];
+        if(!aabb_segment_overlap(node->aabb, from, to)) continue;
+        if(is_leaf(node)) {
+            if(!aabb_segment_overlap(node->tight, from, to) || !broadphase_filter_pass(node->filter, filter)) continue;
+            if(!callback(node->id, udata)) break;
+        }else {
+            if(stack_size+2 > capacity) stack = grow_stack(stack, local, &capacity, stack_size);
+            stack[stack_size++] = node->child1;
+            stack[stack_size++] = node->child2;
+        }
+    }
+    if(stack != local) free(stack);
+}
+
+// Broadphase
+void broadphase_init(Broadphase *broadphase, enum broadphase_type type, float cell_size, float margin) {
+    broadphase->type = type;
+    spatial_hash_init(&broadphase->grid, cell_size);
+    aabb_tree_init(&broadphase->tree, margin);
+    broadphase->tree_proxies = NULL;
+    vec_init(broadphase->tree_proxies, 256);
+    broadphase->frame = 0;
+    for(size_t layer=0;layer<BROADPHASE_LAYERS;layer++) {
+        broadphase->layer_pairs[layer] = BROADPHASE_ALL_LAYERS;
+    }
+}
+
+void broadphase_free(Broadphase *broadphase) {
+    spatial_hash_free(&broadphase->grid);
+    aabb_tree_free(&broadphase->tree);
+    vec_free(broadphase->tree_proxies);
+}
+
+void broadphase_set_layer_pair(Broadphase *broadphase, uint32_t layer_a, uint32_t layer_b, bool collide) {
+    if(collide) {
+        broadphase->layer_pairs[layer_a] |= 1u<<layer_b;
+        broadphase->layer_pairs[layer_b] |= 1u<<layer_a;
+    }else {
+        broadphase->layer_pairs[layer_a] &= ~(1u<<layer_b);
+        broadphase->layer_pairs[layer_b] &= ~(1u<<layer_a);
+    }
+}
+
+// Folds the pair matrix into the mask so queries only need the bitmask test
+static BroadphaseFilter apply_layer_pairs(Broadphase *broadphase, BroadphaseFilter filter) {
+    uint32_t allowed = 0;
+    for(uint32_t layers=filter.layer;layers;layers&=layers-1) {
+        allowed |= broadphase->layer_pairs[__builtin_ctz(layers)];
+    }
+    filter.mask &= allowed;
+    return filter;
+}
+
+void broadphase_begin(Broadphase *broadphase) {
+    broadphase->frame++;
+    if(broadphase->type == BROADPHASE_GRID) spatial_hash_clear(&broadphase->grid);
+}
+
+void broadphase_update(Broadphase *broadphase, uint32_t id, AABB aabb, BroadphaseFilter filter) {
+    filter = apply_layer_pairs(broadphase, filter);
+    if(broadphase->type == BROADPHASE_GRID) {
+        spatial_hash_insert(&broadphase->grid, id, aabb, filter);
+        return;
+    }
+    while(vec_size(broadphase->tree_proxies) <= id) {
+        vec_push(broadphase->tree_proxies, AABB_TREE_NULL);
+    }
+    int32_t proxy = broadphase->tree_proxies[id];
+    if(proxy == AABB_TREE_NULL) {
+        proxy = aabb_tree_create_proxy(&broadphase->tree, id, aabb, filter);
+        broadphase->tree_proxies[id] = proxy;
+    }else {
+        aabb_tree_move_proxy(&broadphase->tree, proxy, aabb);
+        broadphase->tree.nodes[proxy].filter = filter;
+    }
+    broadphase->tree.nodes[proxy].frame = broadphase->frame;
+}
+
+void broadphase_end(Broadphase *broadphase) {
+    if(broadphase->type == BROADPHASE_GRID) {
+        spatial_hash_build(&broadphase->grid);
+        return;
+    }
+    AABBTree *tree = &broadphase->tree;
+    for(int32_t node_ind=0;node_ind<(int32_t)vec_size(tree->nodes);node_ind++) {
+        AABBTreeNode *node = &tree->nodes[node_ind];
+        if(node->height != 0 || node->frame == broadphase->frame) continue;
+        broadphase->tree_proxies[node->id] = AABB_TREE_NULL;
+        aabb_tree_destroy_proxy(tree, node_ind);
+    }
+}
+
+void broadphase_query(Broadphase *broadphase, AABB aabb, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    filter = apply_layer_pairs(broadphase, filter);
+    if(broadphase->type == BROADPHASE_GRID) spatial_hash_query(&broadphase->grid, aabb, filter, callback, udata);
+    else aabb_tree_query(&broadphase->tree, aabb, filter, callback, udata);
+}
+
+void broadphase_raycast(Broadphase *broadphase, Vector2 from, Vector2 to, BroadphaseFilter filter, broadphase_query_func_t callback, void *udata) {
+    filter = apply_layer_pairs(broadphase, filter);
+    if(broadphase->type == BROADPHASE_TREE) {
+        aabb_tree_raycast(&broadphase->tree, from, to, filter, callback, udata);
+        return;
+    }
+    spatial_hash_raycast(&broadphase->grid, from, to, filter, callback, udata);
+}
+
+struct pair_query {
+    uint32_t id;
+    broadphase_pair_func_t callback;
+    void *udata;
+};
+
+static bool pair_query_report(uint32_t id, void *udata) {
+    struct pair_query *query = udata;
+    if(id > query->id) query->callback(query->id, id, query->udata);
+    return true;
+}
+
+void broadphase_pairs(Broadphase *broadphase, broadphase_pair_func_t callback, void *udata) {
+    struct pair_query query = {0, callback, udata};
+    if(broadphase->type == BROADPHASE_GRID) {
+        SpatialHash *grid = &broadphase->grid;
+        for(BroadphaseProxy *proxy=vec_begin(grid->proxies);proxy<vec_end(grid->proxies);proxy++) {
+            query.id = proxy->id;
+            spatial_hash_query(grid, proxy->aabb, proxy->filter, pair_query_report, &query);
+        }
+        return;
+    }
+    AABBTree *tree = &broadphase->tree;
+    for(AABBTreeNode *node=vec_begin(tree->nodes);node<vec_end(tree->nodes);node++) {
+        if(node->height != 0) continue;
+        query.id = node->id;
+        aabb_tree_query(tree, node->tight, node->filter, pair_query_report, &query);
+    }
+}
@@ -0,0 +1,489 @@
+#include <math.h>
+#include <string.h>
+#include "../include/vector.h"
+#include "../include/collision.h"
+#include "raymath.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Vertex Pool
+struct vertex_set {
+    uint32_t offset;
+    uint32_t n_of_vertices;
+};
+
+// Same offsets in all three, the SoA copy feeds the support kernel
+static Vector2 *vertex_pool = NULL;
+static float *vertex_pool_xs = NULL;
+static float *vertex_pool_ys = NULL;
+static struct hashmap *vertex_sets = NULL;
+
+static uint64_t vertex_set_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct vertex_set *set = item;
+    return hashmap_murmur(&vertex_pool[set->offset], sizeof(Vector2)*set->n_of_vertices, seed0, seed1);
+}
+
+static int vertex_set_compare(const void *a, const void *b, void *udata) {
+    const struct vertex_set *sa = a;
+    const struct vertex_set *sb = b;
+    if(sa->n_of_vertices != sb->n_of_vertices) return sa->n_of_vertices < sb->n_of_vertices ? -1 : 1;
+    return memcmp(&vertex_pool[sa->offset], &vertex_pool[sb->offset], sizeof(Vector2)*sa->n_of_vertices);
+}
+
+uint32_t vertex_pool_add(const Vector2 *vertices, uint32_t n_of_vertices) {
+    if(vertex_pool == NULL) {
+        vec_init(vertex_pool, 256);
+        vec_init(vertex_pool_xs, 256);
+        vec_init(vertex_pool_ys, 256);
+        vertex_sets = hashmap_new(sizeof(struct vertex_set), 0, 0, 0, vertex_set_hash, vertex_set_compare, NULL, NULL);
+    }
+    // The candidate goes at the end of the pool so it can be hashed like the stored sets, it's dropped again if it exists
+    struct vertex_set set = {vec_size(vertex_pool), n_of_vertices};
+    uint32_t padded = (n_of_vertices+VERTEX_POOL_PADDING-1)/VERTEX_POOL_PADDING*VERTEX_POOL_PADDING;
+    for(uint32_t ind=0;ind<padded;ind++) {
+        Vector2 vertex = vertices[ind < n_of_vertices ? ind : n_of_vertices-1];
+        vec_push(vertex_pool, vertex);
+        vec_push(vertex_pool_xs, vertex.x);
+        vec_push(vertex_pool_ys, vertex.y);
+    }
+    const struct vertex_set *existing = hashmap_get(vertex_sets, &set);
+    if(existing) {
+        vec_get_base(vertex_pool)->size = set.offset;
+        vec_get_base(vertex_pool_xs)->size = set.offset;
+        vec_get_base(vertex_pool_ys)->size = set.offset;
+        return existing->offset;
+    }
+    hashmap_set(vertex_sets, &set);
+    return set.offset;
+}
+
+const Vector2 *vertex_pool_vertices(uint32_t offset) {
+    return &vertex_pool[offset];
+}
+
+size_t vertex_pool_size() {
+    return vertex_pool ? vec_size(vertex_pool) : 0;
+}
+
+void vertex_pool_free() {
+    if(vertex_pool == NULL) return;
+    vec_free(vertex_pool);
+    vec_free(vertex_pool_xs);
+    vec_free(vertex_pool_ys);
+    hashmap_free(vertex_sets);
+    vertex_pool = NULL;
+    vertex_pool_xs = NULL;
+    vertex_pool_ys = NULL;
+    vertex_sets = NULL;
+}
+
+ColliderInfo collider_info_vertices(const Vector2 *vertices, uint32_t n_of_vertices) {
+    ColliderInfo info = {0};
+    info.collider_t = COLLIDER_VERTICES;
+    info.vertices_info.offset = vertex_pool_add(vertices, n_of_vertices);
+    info.vertices_info.n_of_vertices = n_of_vertices;
+    return info;
+}
+
+Vector2 support_function_vertices(Vector2 position, const Vector2 *vertices, size_t n_of_vertices, Vector2 dir) {
+    Vector2 v0 = Vector2Add(position, vertices[0]);
+    float dotmax = Vector2DotProduct(v0, dir);
+    Vector2 vmax = v0;
+    for(size_t ind=1;ind<n_of_vertices;ind++) {
+        Vector2 v = Vector2Add(vertices[ind], position);
+        float dot = Vector2DotProduct(v, dir);
+        if(dot>dotmax) {
+            vmax=v;
+            dotmax = dot;
+        }
+    }
+    return vmax;
+}
+
+#if defined(__AVX__)
+size_t support_simd_width() { return 8; }
+
+Vector2 support_function_vertices_soa(Vector2 position, const float *xs, const float *ys, size_t n_of_vertices, Vector2 dir) {
+    __m256 dir_x = _mm256_set1_ps(dir.x);
+    __m256 dir_y = _mm256_set1_ps(dir.y);
+    __m256 best = _mm256_set1_ps(-INFINITY);
+    __m256 best_ind = _mm256_setzero_ps();
+    __m256 ind = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 step = _mm256_set1_ps(8);
+    for(size_t base=0;base<n_of_vertices;base+=8) {
+        __m256 dot = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(&xs[base]), dir_x), _mm256_mul_ps(_mm256_loadu_ps(&ys[base]), dir_y));
+        __m256 greater = _mm256_cmp_ps(dot, best, _CMP_GT_OQ);
+        best = _mm256_blendv_ps(best, dot, greater);
+        best_ind = _mm256_blendv_ps(best_ind, ind, greater);
+        ind = _mm256_add_ps(ind, step);
+    }
+    // Horizontal max, then the first lane holding it
+    __m128 max = _mm_max_ps(_mm256_castps256_ps128(best), _mm256_extractf128_ps(best, 1));
+    max = _mm_max_ps(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(2,3,0,1)));
+    max = _mm_max_ps(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1,0,3,2)));
+    __m256 max_all = _mm256_insertf128_ps(_mm256_castps128_ps256(max), max, 1);
+    int lane = __builtin_ctz(_mm256_movemask_ps(_mm256_cmp_ps(best, max_all, _CMP_EQ_OQ)));
+    float lane_ind[8];
+    _mm256_storeu_ps(lane_ind, best_ind);
+    size_t best_vertex = lane_ind[lane];
+#elif defined(__SSE2__)
+size_t support_simd_width() { return 4; }
+
+Vector2 support_function_vertices_soa(Vector2 position, const float *xs, const float *ys, size_t n_of_vertices, Vector2 dir) {
+    __m128 dir_x = _mm_set1_ps(dir.x);
+    __m128 dir_y = _mm_set1_ps(dir.y);
+    __m128 best = _mm_set1_ps(-INFINITY);
+    __m128 best_ind = _mm_setzero_ps();
+    __m128 ind = _mm_setr_ps(0, 1, 2, 3);
+    __m128 step = _mm_set1_ps(4);
+    for(size_t base=0;base<n_of_vertices;base+=4) {
+        __m128 dot = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&xs[base]), dir_x), _mm_mul_ps(_mm_loadu_ps(&ys[base]), dir_y));
+        __m128 greater = _mm_cmpgt_ps(dot, best);
+        best = _mm_or_ps(_mm_and_ps(greater, dot), _mm_andnot_ps(greater, best));
+        best_ind = _mm_or_ps(_mm_and_ps(greater, ind), _mm_andnot_ps(greater, best_ind));
+        ind = _mm_add_ps(ind, step);
+    }
+    __m128 max = _mm_max_ps(best, _mm_shuffle_ps(best, best, _MM_SHUFFLE(2,3,0,1)));
+    max = _mm_max_ps(max, _mm_shuffle_ps(max, max, _MM_SHUFFLE(1,0,3,2)));
+    int lane = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(best, max)));
+    float lane_ind[4];
+    _mm_storeu_ps(lane_ind, best_ind);
+    size_t best_vertex = lane_ind[lane];
+#else
+size_t support_simd_width() { return 1; }
+
+Vector2 support_function_vertices_soa(Vector2 position, const float *xs, const float *ys, size_t n_of_vertices, Vector2 dir) {
+    float best = -INFINITY;
+    size_t best_vertex = 0;
+    for(size_t ind=0;ind<n_of_vertices;ind++) {
+        float dot = xs[ind]*dir.x + ys[ind]*dir.y;
+        if(dot > best) {
+            best = dot;
+            best_vertex = ind;
+        }
+    }
+#endif
+    return (Vector2){position.x+xs[best_vertex], position.y+ys[best_vertex]};
+}
+
+Vector2 support_function_circle(Vector2 center, float radius, Vector2 dir) {
+    return Vector2Add(center, Vector2Scale(dir,radius));
+}
+
+Vector2 support_function_box(Vector2 min, Vector2 size, Vector2 dir) {
+    return (Vector2){dir.x > 0 ? min.x+size.x : min.x, dir.y > 0 ? min.y+size.y : min.y};
+}
+
+Vector2 support_function(Vector2 position, const ColliderInfo *collider_info, Vector2 dir) {
+    switch(collider_info->collider_t) {
+        case COLLIDER_VERTICES:
+            return support_function_vertices_soa(position, &vertex_pool_xs[collider_info->vertices_info.offset], &vertex_pool_ys[collider_info->vertices_info.offset], collider_info->vertices_info.n_of_vertices, dir);
+        case COLLIDER_CIRCLE:
+            return support_function_circle(Vector2Add(position,collider_info->circle_info.offset), collider_info->circle_info.radius, dir);
+        case COLLIDER_BOX:
+            return support_function_box(Vector2Add(position,collider_info->box_info.offset), collider_info->box_info.size, dir);
+        default:
+            return position;
+    }
+}
+
+static inline Vector2 minkowski_support(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 dir) {
+    return Vector2Subtract(support_function(position_a, a, dir), support_function(position_b, b, Vector2Scale(dir,-1.f)));
+}
+
+bool gjk_intersect(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir_io, Vector2 simplex_out[3]) {
+    size_t simplex_vertices = 0;
+    Vector2 simplex[3] = {0};
+    Vector2 dir = Vector2Normalize(*dir_io);
+    if(dir.x == 0 && dir.y == 0) dir = Vector2Normalize((Vector2){1,1});
+
+    simplex[simplex_vertices] = minkowski_support(position_a, a, position_b, b, dir);
+    // Nothing reaches past the origin along dir, dir separates the shapes
+    if (Vector2DotProduct(simplex[0], dir) < 0) {
+        *dir_io = dir;
+        return false;
+    }
+    dir = Vector2Normalize(Vector2Scale(simplex[0],-1));
+
+    while(1) {
+        simplex[++simplex_vertices] = minkowski_support(position_a, a, position_b, b, dir);
+        if (Vector2DotProduct(simplex[simplex_vertices], dir) <= 0) {
+            *dir_io = dir;
+            return false;
+        }
+
+        // p1 - newest vertex
+        Vector2 p1_to_p2 = Vector2Subtract(simplex[simplex_vertices-1], simplex[simplex_vertices]);
+        Vector2 p1_to_origin = Vector2Scale(simplex[simplex_vertices], -1);
+        Vector3 p1_to_p2_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p2.x,p1_to_p2.y,0}, (Vector3){p1_to_origin.x,p1_to_origin.y,0}),(Vector3){p1_to_p2.x,p1_to_p2.y,0});
+        if(simplex_vertices<2) {
+            dir = Vector2Normalize((Vector2){p1_to_p2_perpendicular.x,p1_to_p2_perpendicular.y});
+            continue;
+        }
+        Vector2 p1_to_p3 = Vector2Subtract(simplex[0], simplex[simplex_vertices]);
+        p1_to_p2_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p3.x,p1_to_p3.y,0}, (Vector3){p1_to_p2.x,p1_to_p2.y,0}),(Vector3){p1_to_p2.x,p1_to_p2.y,0});
+        Vector3 p1_to_p3_perpendicular = Vector3CrossProduct(Vector3CrossProduct((Vector3){p1_to_p2.x,p1_to_p2.y,0}, (Vector3){p1_to_p3.x,p1_to_p3.y,0}),(Vector3){p1_to_p3.x,p1_to_p3.y,0});
+
+        if(Vector3DotProduct((Vector3){p1_to_origin.x, p1_to_origin.y,0}, p1_to_p2_perpendicular)>=0) {
+            simplex[0]=simplex[1];
+            dir=Vector2Normalize((Vector2){p1_to_p2_perpendicular.x, p1_to_p2_perpendicular.y});
+        }else if(Vector3DotProduct((Vector3){p1_to_origin.x, p1_to_origin.y,0}, p1_to_p3_perpendicular)>=0) {
+            dir=Vector2Normalize((Vector2){p1_to_p3_perpendicular.x, p1_to_p3_perpendicular.y});
+        }else {
+            memcpy(simplex_out, simplex, sizeof(simplex));
+            *dir_io = dir;
+            return true;
+        }
+        simplex[1]=simplex[2];
+        simplex_vertices--;
+    }
+    return false;
+}
+
+Penetration epa_penetration(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 simplex[3]) {
+    Vector2 polytope[EPA_MAX_VERTICES];
+    size_t n_of_vertices = 3;
+    memcpy(polytope, simplex, sizeof(Vector2)*3);
+
+    // winding of simplex
+    float e0 = (polytope[1].x-polytope[0].x) * (polytope[1].y + polytope[0].y);
+    float e1 = (polytope[2].x - polytope[1].x) * (polytope[2].y + polytope[1].y);
+    float e2 = (polytope[0].x - polytope[2].x) * (polytope[0].y + polytope[2].y);
+    bool clockwise_winding = (e0 + e1 + e2 >= 0);
+
+    Vector2 closest_normal = {0};
+    float closest_dist = 0.f;
+    for(int it=0;it<EPA_MAX_ITERATIONS;it++) {
+        // Find closest edge to origin
+        size_t closest_ind = 0;
+        closest_dist = INFINITY;
+        for(size_t i=0;i<n_of_vertices;i++) {
+            size_t j = (i+1)%n_of_vertices;
+            Vector2 edge = Vector2Subtract(polytope[j], polytope[i]);
+            // outward-facing normal of the edge
+            Vector2 edge_normal_out = clockwise_winding ? (Vector2){-edge.y,edge.x} : (Vector2){edge.y,-edge.x};
+            if(edge_normal_out.x == 0 && edge_normal_out.y == 0) continue;
+            edge_normal_out = Vector2Normalize(edge_normal_out);
+
+            float dist = Vector2DotProduct(edge_normal_out, polytope[i]);
+            if(dist < closest_dist) {
+                closest_dist = dist;
+                closest_normal = edge_normal_out;
+                closest_ind = j;
+            }
+        }
+
+        Vector2 sup = minkowski_support(position_a, a, position_b, b, closest_normal);
+        float dist = Vector2DotProduct(sup, closest_normal);
+        if(dist-closest_dist <= EPA_TOLERANCE || n_of_vertices == EPA_MAX_VERTICES) break;
+
+        // Insert the support point between the closest edge's vertices
+        memmove(&polytope[closest_ind+1], &polytope[closest_ind], sizeof(Vector2)*(n_of_vertices-closest_ind));
+        polytope[closest_ind] = sup;
+        n_of_vertices++;
+    }
+
+    Penetration penetration;
+    penetration.normal = closest_normal;
+    penetration.depth = closest_dist;
+    penetration.point = support_function(position_a, a, closest_normal);
+    return penetration;
+}
+
+// Narrowphase
+static bool collide_gjk(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    if(!gjk_intersect(position_a, a, position_b, b, dir, simplex)) return false;
+    *penetration = epa_penetration(position_a, a, position_b, b, simplex);
+    return true;
+}
+
+static bool collide_circle_circle(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    Vector2 center_a = Vector2Add(position_a, a->circle_info.offset);
+    Vector2 center_b = Vector2Add(position_b, b->circle_info.offset);
+    float radii = a->circle_info.radius + b->circle_info.radius;
+    Vector2 delta = Vector2Subtract(center_b, center_a);
+    float dist_sq = Vector2DotProduct(delta, delta);
+    if(dist_sq >= radii*radii) return false;
+
+    float dist = sqrtf(dist_sq);
+    penetration->normal = dist > 0 ? Vector2Scale(delta, 1.f/dist) : (Vector2){1,0};
+    penetration->depth = radii - dist;
+    penetration->point = Vector2Add(center_a, Vector2Scale(penetration->normal, a->circle_info.radius - penetration->depth/2));
+    return true;
+}
+
+static bool collide_circle_box(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    Vector2 center = Vector2Add(position_a, a->circle_info.offset);
+    float radius = a->circle_info.radius;
+    Vector2 min = Vector2Add(position_b, b->box_info.offset);
+    Vector2 max = Vector2Add(min, b->box_info.size);
+    Vector2 closest = {fminf(fmaxf(center.x, min.x), max.x), fminf(fmaxf(center.y, min.y), max.y)};
+    Vector2 delta = Vector2Subtract(closest, center);
+    float dist_sq = Vector2DotProduct(delta, delta);
+
+    if(dist_sq > 0) {
+        if(dist_sq >= radius*radius) return false;
+        float dist = sqrtf(dist_sq);
+        penetration->normal = Vector2Scale(delta, 1.f/dist);
+        penetration->depth = radius - dist;
+        penetration->point = closest;
+        return true;
+    }
+
+    // Center inside the box, push the circle out through the nearest face
+    float faces[4] = {center.x-min.x, max.x-center.x, center.y-min.y, max.y-center.y};
+    Vector2 normals[4] = {{1,0}, {-1,0}, {0,1}, {0,-1}};
+    int nearest = 0;
+    for(int ind=1;ind<4;ind++) {
+        if(faces[ind] < faces[nearest]) nearest = ind;
+    }
+    penetration->normal = normals[nearest];
+    penetration->depth = faces[nearest] + radius;
+    penetration->point = center;
+    return true;
+}
+
+static bool collide_box_circle(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    if(!collide_circle_box(position_b, b, position_a, a, dir, simplex, penetration)) return false;
+    penetration->normal = Vector2Scale(penetration->normal, -1.f);
+    return true;
+}
+
+// SAT on the two axes
+static bool collide_box_box(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    Vector2 min_a = Vector2Add(position_a, a->box_info.offset);
+    Vector2 max_a = Vector2Add(min_a, a->box_info.size);
+    Vector2 min_b = Vector2Add(position_b, b->box_info.offset);
+    Vector2 max_b = Vector2Add(min_b, b->box_info.size);
+    float overlap_x = fminf(max_a.x, max_b.x) - fmaxf(min_a.x, min_b.x);
+    float overlap_y = fminf(max_a.y, max_b.y) - fmaxf(min_a.y, min_b.y);
+    if(overlap_x <= 0 || overlap_y <= 0) return false;
+
+    if(overlap_x < overlap_y) {
+        penetration->normal = (Vector2){min_b.x+max_b.x > min_a.x+max_a.x ? 1.f : -1.f, 0};
+        penetration->depth = overlap_x;
+    }else {
+        penetration->normal = (Vector2){0, min_b.y+max_b.y > min_a.y+max_a.y ? 1.f : -1.f};
+        penetration->depth = overlap_y;
+    }
+    // Center of the overlap
+    penetration->point = (Vector2){
+        (fmaxf(min_a.x, min_b.x) + fminf(max_a.x, max_b.x))/2,
+        (fmaxf(min_a.y, min_b.y) + fminf(max_a.y, max_b.y))/2
+    };
+    return true;
+}
+
+static const narrowphase_func_t narrowphase_table[COLLIDER_TYPES][COLLIDER_TYPES] = {
+    [COLLIDER_VERTICES] = {
+        [COLLIDER_VERTICES] = collide_gjk,
+        [COLLIDER_CIRCLE] = collide_gjk,
+        [COLLIDER_BOX] = collide_gjk
+    },
+    [COLLIDER_CIRCLE] = {
+        [COLLIDER_VERTICES] = collide_gjk,
+        [COLLIDER_CIRCLE] = collide_circle_circle,
+        [COLLIDER_BOX] = collide_circle_box
+    },
+    [COLLIDER_BOX] = {
+        [COLLIDER_VERTICES] = collide_gjk,
+        [COLLIDER_CIRCLE] = collide_box_circle,
+        [COLLIDER_BOX] = collide_box_box
+    }
+};
+
+bool narrowphase_collide(Vector2 position_a, const ColliderInfo *a, Vector2 position_b, const ColliderInfo *b, Vector2 *dir, Vector2 simplex[3], Penetration *penetration) {
+    return narrowphase_table[a->collider_t][b->collider_t](position_a, a, position_b, b, dir, simplex, penetration);
+}
+
+// Contact Cache
+static int contact_compare(const void *a, const void *b, void *udata) {
+    const Contact *ca = a;
+    const Contact *cb = b;
+    if(ca->a != cb->a) return ca->a < cb->a ? -1 : 1;
+    return (ca->b > cb->b) - (ca->b < cb->b);
+}
+
+static uint64_t contact_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const Contact *contact = item;
+    uint32_t key[2] = {contact->a, contact->b};
+    return hashmap_murmur(key, sizeof(key), seed0, seed1);
+}
+
+static void contact_cache_push_event(ContactCache *cache, enum contact_event_type type, uint32_t a, uint32_t b) {
+    ContactEvent event = {type, a, b};
+    vec_push(cache->events, event);
+}
+
+void contact_cache_init(ContactCache *cache) {
+    cache->contacts = hashmap_new(sizeof(Contact), 0, 0, 0, contact_hash, contact_compare, NULL, NULL);
+    cache->events = NULL;
+    vec_init(cache->events, 64);
+    cache->stale = NULL;
+    vec_init(cache->stale, 16);
+    cache->frame = 0;
+}
+
+void contact_cache_free(ContactCache *cache) {
+    hashmap_free(cache->contacts);
+    vec_free(cache->events);
+    vec_free(cache->stale);
+}
+
+void contact_cache_begin(ContactCache *cache) {
+    cache->frame++;
+    vec_get_base(cache->events)->size = 0;
+}
+
+Contact *contact_cache_find(ContactCache *cache, uint32_t a, uint32_t b) {
+    if(a > b) {
+        uint32_t tmp = a;
+        a = b;
+        b = tmp;
+    }
+    return (Contact*)hashmap_get(cache->contacts, &(Contact){.a=a, .b=b});
+}
+
+Contact *contact_cache_get(ContactCache *cache, uint32_t a, uint32_t b) {
+    if(a > b) {
+        uint32_t tmp = a;
+        a = b;
+        b = tmp;
+    }
+    Contact *contact = (Contact*)hashmap_get(cache->contacts, &(Contact){.a=a, .b=b});
+    if(contact == NULL) {
+        hashmap_set(cache->contacts, &(Contact){.a=a, .b=b});
+        contact = (Contact*)hashmap_get(cache->contacts, &(Contact){.a=a, .b=b});
+    }
+    contact->frame = cache->frame;
+    return contact;
+}
+
+void contact_cache_report(ContactCache *cache, Contact *contact, bool touching) {
+    if(touching) {
+        contact_cache_push_event(cache, contact->touching ? CONTACT_STAY : CONTACT_BEGIN, contact->a, contact->b);
+    }else if(contact->touching) {
+        contact_cache_push_event(cache, CONTACT_END, contact->a, contact->b);
+    }
+    contact->touching = touching;
+}
+
+void contact_cache_end(ContactCache *cache) {
+    // Deleting while iterating isn't safe, stale keys are collected first
+    vec_get_base(cache->stale)->size = 0;
+    size_t iter = 0;
+    void *item;
+    while(hashmap_iter(cache->contacts, &iter, &item)) {
+        Contact *contact = item;
+        if(contact->frame == cache->frame) continue;
+        if(contact->touching) contact_cache_push_event(cache, CONTACT_END, contact->a, contact->b);
+        vec_push(cache->stale, *contact);
+    }
+    for(Contact *contact=vec_begin(cache->stale);contact<vec_end(cache->stale);contact++) {
+        hashmap_delete(cache->contacts, contact);
+    }
+}
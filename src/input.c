@@ -0,0 +1,288 @@
+#include "../include/input.h"
+
+#include <string.h>
+
+static InputSource source;
+
+void input_set_source(InputSource new_source) {
+    source = new_source;
+}
+
+float input_frame_time() {
+    return source.frame_time(source.udata);
+}
+
+bool input_key_down(int key) {
+    return source.key_down(key, source.udata);
+}
+
+bool input_key_pressed(int key) {
+    return source.key_pressed(key, source.udata);
+}
+
+Vector2 input_mouse_position() {
+    return source.mouse_position(source.udata);
+}
+
+bool input_mouse_down(int button) {
+    return source.mouse_down(button, source.udata);
+}
+
+bool input_mouse_pressed(int button) {
+    return source.mouse_pressed(button, source.udata);
+}
+
+bool input_begin_tick() {
+    return source.begin_tick == NULL || source.begin_tick(source.udata);
+}
+
+void input_end_tick() {
+    if(source.end_tick) source.end_tick(source.udata);
+}
+
+#ifndef HEADLESS
+static float raylib_tick_dt;
+static bool raylib_pressed[INPUT_MAX_KEYS];
+static bool raylib_mouse_pressed[INPUT_MAX_BUTTONS];
+
+static float raylib_frame_time(void *udata) {
+    return raylib_tick_dt;
+}
+
+static bool raylib_key_down(int key, void *udata) {
+    return IsKeyDown(key);
+}
+
+static bool raylib_key_pressed(int key, void *udata) {
+    return key >= 0 && key < INPUT_MAX_KEYS && raylib_pressed[key];
+}
+
+static Vector2 raylib_mouse_position(void *udata) {
+    return GetMousePosition();
+}
+
+static bool raylib_mouse_down(int button, void *udata) {
+    return IsMouseButtonDown(button);
+}
+
+static bool raylib_mouse_pressed_func(int button, void *udata) {
+    return button >= 0 && button < INPUT_MAX_BUTTONS && raylib_mouse_pressed[button];
+}
+
+static void raylib_end_tick(void *udata) {
+    memset(raylib_pressed, 0, sizeof(raylib_pressed));
+    memset(raylib_mouse_pressed, 0, sizeof(raylib_mouse_pressed));
+}
+
+InputSource input_raylib_source(float tick_dt) {
+    raylib_tick_dt = tick_dt;
+    raylib_end_tick(NULL);
+    return (InputSource){raylib_frame_time, raylib_key_down, raylib_key_pressed,
+        raylib_mouse_position, raylib_mouse_down, raylib_mouse_pressed_func, NULL, raylib_end_tick, NULL};
+}
+
+void input_raylib_poll() {
+    for(int key=GetKeyPressed();key!=0;key=GetKeyPressed()) {
+        if(key > 0 && key < INPUT_MAX_KEYS) raylib_pressed[key] = true;
+    }
+    for(int button=0;button<INPUT_MAX_BUTTONS;button++) {
+        if(IsMouseButtonPressed(button)) raylib_mouse_pressed[button] = true;
+    }
+}
+#endif
+
+static float fixed_frame_time(void *udata) {
+    return ((FixedInput*)udata)->dt;
+}
+
+static bool fixed_key_down(int key, void *udata) {
+    return key >= 0 && key < INPUT_MAX_KEYS && ((FixedInput*)udata)->down[key];
+}
+
+static bool fixed_key_pressed(int key, void *udata) {
+    return key >= 0 && key < INPUT_MAX_KEYS && ((FixedInput*)udata)->pressed[key];
+}
+
+static Vector2 fixed_mouse_position(void *udata) {
+    return ((FixedInput*)udata)->mouse_position;
+}
+
+static bool fixed_mouse_down(int button, void *udata) {
+    return button >= 0 && button < INPUT_MAX_BUTTONS && ((FixedInput*)udata)->mouse_down[button];
+}
+
+static bool fixed_mouse_pressed(int button, void *udata) {
+    return button >= 0 && button < INPUT_MAX_BUTTONS && ((FixedInput*)udata)->mouse_pressed[button];
+}
+
+static void fixed_end_tick(void *udata) {
+    FixedInput *input = udata;
+    memset(input->pressed, 0, sizeof(input->pressed));
+    memset(input->mouse_pressed, 0, sizeof(input->mouse_pressed));
+}
+
+InputSource input_fixed_source(FixedInput *input) {
+    return (InputSource){fixed_frame_time, fixed_key_down, fixed_key_pressed,
+        fixed_mouse_position, fixed_mouse_down, fixed_mouse_pressed, NULL, fixed_end_tick, input};
+}
+
+// Every field is written little endian byte by byte, so logs move between hosts and carry no padding.
+// Tick record: dt, mouse x and y as IEEE floats, mouse down and pressed bits, key counts, then the key codes.
+#define REPLAY_RECORD_BYTES 18
+
+static void replay_put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+}
+
+static void replay_put_u32(uint8_t *out, uint32_t value) {
+    for(int ind=0;ind<4;ind++) out[ind] = value >> 8*ind;
+}
+
+static void replay_put_f32(uint8_t *out, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    replay_put_u32(out, bits);
+}
+
+static uint16_t replay_get_u16(const uint8_t *in) {
+    return in[0] | in[1] << 8;
+}
+
+static uint32_t replay_get_u32(const uint8_t *in) {
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static float replay_get_f32(const uint8_t *in) {
+    uint32_t bits = replay_get_u32(in);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void replay_write_tick(FILE *file, const FixedInput *tick) {
+    uint8_t record[REPLAY_RECORD_BYTES];
+    uint8_t keys[2*2*INPUT_MAX_KEYS];
+    uint8_t mouse_down = 0, mouse_pressed = 0;
+    uint16_t n_of_down = 0, n_of_pressed = 0;
+    for(int button=0;button<INPUT_MAX_BUTTONS;button++) {
+        mouse_down |= tick->mouse_down[button] << button;
+        mouse_pressed |= tick->mouse_pressed[button] << button;
+    }
+    for(uint16_t key=0;key<INPUT_MAX_KEYS;key++) {
+        if(tick->down[key]) replay_put_u16(&keys[2*n_of_down++], key);
+    }
+    for(uint16_t key=0;key<INPUT_MAX_KEYS;key++) {
+        if(tick->pressed[key]) replay_put_u16(&keys[2*(n_of_down + n_of_pressed++)], key);
+    }
+    replay_put_f32(&record[0], tick->dt);
+    replay_put_f32(&record[4], tick->mouse_position.x);
+    replay_put_f32(&record[8], tick->mouse_position.y);
+    record[12] = mouse_down;
+    record[13] = mouse_pressed;
+    replay_put_u16(&record[14], n_of_down);
+    replay_put_u16(&record[16], n_of_pressed);
+    fwrite(record, sizeof(record), 1, file);
+    fwrite(keys, 2, n_of_down + n_of_pressed, file);
+}
+
+static bool replay_read_tick(FILE *file, FixedInput *tick) {
+    uint8_t record[REPLAY_RECORD_BYTES];
+    uint8_t keys[2*2*INPUT_MAX_KEYS];
+    if(fread(record, sizeof(record), 1, file) != 1) return false;
+    uint16_t n_of_down = replay_get_u16(&record[14]);
+    size_t n_of_keys = n_of_down + replay_get_u16(&record[16]);
+    if(n_of_keys > 2*INPUT_MAX_KEYS || fread(keys, 2, n_of_keys, file) != n_of_keys) return false;
+
+    memset(tick, 0, sizeof(FixedInput));
+    tick->dt = replay_get_f32(&record[0]);
+    tick->mouse_position = (Vector2){replay_get_f32(&record[4]), replay_get_f32(&record[8])};
+    for(int button=0;button<INPUT_MAX_BUTTONS;button++) {
+        tick->mouse_down[button] = record[12] >> button & 1;
+        tick->mouse_pressed[button] = record[13] >> button & 1;
+    }
+    for(size_t ind=0;ind<n_of_keys;ind++) {
+        uint16_t key = replay_get_u16(&keys[2*ind]);
+        if(key >= INPUT_MAX_KEYS) continue;
+        if(ind < n_of_down) tick->down[key] = true;
+        else tick->pressed[key] = true;
+    }
+    return true;
+}
+
+bool input_record_open(InputReplay *replay, const char *path, uint32_t seed) {
+    memset(replay, 0, sizeof(InputReplay));
+    replay->file = fopen(path, "wb");
+    if(replay->file == NULL) return false;
+    replay->seed = seed;
+    uint8_t header[12];
+    replay_put_u32(&header[0], INPUT_REPLAY_MAGIC);
+    replay_put_u32(&header[4], INPUT_REPLAY_VERSION);
+    replay_put_u32(&header[8], seed);
+    fwrite(header, sizeof(header), 1, replay->file);
+    return true;
+}
+
+// Snapshots the wrapped source so the tick sees exactly what gets written
+static bool record_begin_tick(void *udata) {
+    InputReplay *replay = udata;
+    InputSource *inner = &replay->source;
+    if(inner->begin_tick && !inner->begin_tick(inner->udata)) return false;
+
+    FixedInput *tick = &replay->tick;
+    tick->dt = inner->frame_time(inner->udata);
+    for(int key=0;key<INPUT_MAX_KEYS;key++) {
+        tick->down[key] = inner->key_down(key, inner->udata);
+        tick->pressed[key] = inner->key_pressed(key, inner->udata);
+    }
+    tick->mouse_position = inner->mouse_position(inner->udata);
+    for(int button=0;button<INPUT_MAX_BUTTONS;button++) {
+        tick->mouse_down[button] = inner->mouse_down(button, inner->udata);
+        tick->mouse_pressed[button] = inner->mouse_pressed(button, inner->udata);
+    }
+    replay_write_tick(replay->file, tick);
+    replay->ticks++;
+    return true;
+}
+
+static void record_end_tick(void *udata) {
+    InputReplay *replay = udata;
+    if(replay->source.end_tick) replay->source.end_tick(replay->source.udata);
+}
+
+InputSource input_record_source(InputReplay *replay, InputSource source) {
+    replay->source = source;
+    return (InputSource){fixed_frame_time, fixed_key_down, fixed_key_pressed,
+        fixed_mouse_position, fixed_mouse_down, fixed_mouse_pressed, record_begin_tick, record_end_tick, replay};
+}
+
+bool input_replay_open(InputReplay *replay, const char *path) {
+    memset(replay, 0, sizeof(InputReplay));
+    replay->file = fopen(path, "rb");
+    if(replay->file == NULL) return false;
+    uint8_t header[12];
+    if(fread(header, sizeof(header), 1, replay->file) != 1 || replay_get_u32(&header[0]) != INPUT_REPLAY_MAGIC || replay_get_u32(&header[4]) != INPUT_REPLAY_VERSION) {
+        fclose(replay->file);
+        replay->file = NULL;
+        return false;
+    }
+    replay->seed = replay_get_u32(&header[8]);
+    return true;
+}
+
+static bool replay_begin_tick(void *udata) {
+    InputReplay *replay = udata;
+    if(!replay_read_tick(replay->file, &replay->tick)) return false;
+    replay->ticks++;
+    return true;
+}
+
+InputSource input_replay_source(InputReplay *replay) {
+    return (InputSource){fixed_frame_time, fixed_key_down, fixed_key_pressed,
+        fixed_mouse_position, fixed_mouse_down, fixed_mouse_pressed, replay_begin_tick, NULL, replay};
+}
+
+void input_replay_close(InputReplay *replay) {
+    if(replay->file) fclose(replay->file);
+    replay->file = NULL;
+}
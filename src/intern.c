@@ -0,0 +1,59 @@
+#include <string.h>
+#include "../include/hashmap.h"
+#include "../include/intern.h"
+
+// Lookups use the caller's bytes, stored entries point at their own sds copy
+struct interned {
+    const char *str;
+    size_t len;
+};
+
+static struct hashmap *intern_pool = NULL;
+
+static uint64_t interned_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct interned *interned = item;
+    return hashmap_sip(interned->str, interned->len, seed0, seed1);
+}
+
+static int interned_compare(const void *a, const void *b, void *udata) {
+    const struct interned *ia = a;
+    const struct interned *ib = b;
+    if(ia->len != ib->len) return ia->len < ib->len ? -1 : 1;
+    return memcmp(ia->str, ib->str, ia->len);
+}
+
+const char *intern_string_len(const char *str, size_t len) {
+    if(intern_pool == NULL) {
+        intern_pool = hashmap_new(sizeof(struct interned), 0, 0, 0, interned_hash, interned_compare, NULL, NULL);
+    }
+    const struct interned *existing = hashmap_get(intern_pool, &(struct interned){str, len});
+    if(existing) return existing->str;
+    struct interned interned = {sdsnewlen(str, len), len};
+    hashmap_set(intern_pool, &interned);
+    return interned.str;
+}
+
+const char *intern_string(const char *str) {
+    return intern_string_len(str, strlen(str));
+}
+
+const char *intern_find(const char *str) {
+    if(intern_pool == NULL) return NULL;
+    const struct interned *existing = hashmap_get(intern_pool, &(struct interned){str, strlen(str)});
+    return existing ? existing->str : NULL;
+}
+
+size_t intern_pool_size() {
+    return intern_pool ? hashmap_count(intern_pool) : 0;
+}
+
+void intern_pool_free() {
+    if(intern_pool == NULL) return;
+    size_t iter = 0;
+    void *item;
+    while(hashmap_iter(intern_pool, &iter, &item)) {
+        sdsfree((sds)((struct interned*)item)->str);
+    }
+    hashmap_free(intern_pool);
+    intern_pool = NULL;
+}
@@ -1,57 +1,138 @@
 #include "../include/kxecs.h"
+#include <assert.h>
+#include <time.h>
+
+// Set while the current thread runs a system, structural changes get recorded instead of applied
+static _Thread_local int defer_depth = 0;
+
+static uint64_t __ecs_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static EcsCommandBuffer __ecs_new_command_buffer() {
+    EcsCommandBuffer buffer = {NULL, NULL};
+    vec_init(buffer.commands, 64);
+    vec_init(buffer.data, 1024);
+    return buffer;
+}
 
 // ECS Main
-ECS *init_ecs() { ECS *ecs = malloc(sizeof(ECS)); ecs->components = hashmap_new(sizeof(struct component_kv), 0, 0, 0,component_hash, component_compare, NULL, NULL); ecs->number_of_components = 0; ecs->number_of_entities = 0; uint32_t *signatures = NULL; vec_init(signatures, MAX_ENTITIES); ecs->signatures = signatures;
-    sds *tags = NULL;
-    vec_init(tags, MAX_ENTITIES);
-    vec_get_base(tags)->size = MAX_ENTITIES;
+ECS *init_ecs() {
+    return init_ecs_with_storage(ECS_STORAGE_SPARSE_SET);
+}
+
+ECS *init_ecs_with_storage(enum ecs_storage storage) { ECS *ecs = malloc(sizeof(ECS)); ecs->storage = storage; ecs->components = hashmap_new(sizeof(struct component_kv), 0, 0, 0,component_hash, component_compare, NULL, NULL); ecs->number_of_components = 0; ecs->number_of_resources = 0; ecs->number_of_entities = 0; ecs->structure_version = 0; uint32_t *signatures = NULL; vec_init(signatures, ECS_PAGE_SIZE); ecs->signatures = signatures;
+    ecs_tag_t *tags = NULL;
+    vec_init(tags, ECS_PAGE_SIZE);
     ecs->tags = tags;
+    uint32_t *tag_slots = NULL;
+    vec_init(tag_slots, ECS_PAGE_SIZE);
+    ecs->tag_slots = tag_slots;
+    ecs->tag_ids = hashmap_new(sizeof(struct tag_kv), 0, 0, 0, tag_hash, tag_compare, NULL, NULL);
+    EcsTag *tag_table = NULL;
+    vec_init(tag_table, 16);
+    ecs->tag_table = tag_table;
+    vec_push(ecs->tag_table, ((EcsTag){NULL, NULL}));
+    uint8_t *generations = NULL;
+    vec_init(generations, ECS_PAGE_SIZE);
+    ecs->generations = generations;
 
     for(size_t ind=0;ind<NUM_OF_SYSTEM_TYPES;ind++) {
         SystemCallback *s_call = NULL;
         vec_init(s_call, 16);
         ecs->systems[ind]=s_call;
+        ecs->schedules[ind]=NULL;
+        ecs->schedule_dirty[ind]=true;
     }
+    ecs->jobs = NULL;
+    ecs->parallel_phases = 0;
+    ecs->profiling = false;
+    memset(ecs->phase_profiles, 0, sizeof(ecs->phase_profiles));
+    ecs->profile_epoch = __ecs_now_ns();
 
-    entity_t *entities_to_spawn = NULL;
-    vec_init(entities_to_spawn, 64);
-    ecs->entities_to_spawn = entities_to_spawn;
+    EcsCommandBuffer *command_buffers = NULL;
+    vec_init(command_buffers, 1);
+    ecs->command_buffers = command_buffers;
+    vec_push(ecs->command_buffers, __ecs_new_command_buffer());
 
-    entity_t *entities_to_kill = NULL;
-    vec_init(entities_to_kill, 64);
-    ecs->entities_to_kill = entities_to_kill;
+    EcsPendingCommand *pending_commands = NULL;
+    vec_init(pending_commands, 64);
+    ecs->pending_commands = pending_commands;
 
     entity_t *free_ids = NULL;
     vec_init(free_ids, 64);
     ecs->free_ids = free_ids;
+    ecs->retired_ids = 0;
+    pthread_mutex_init(&ecs->spawn_lock, NULL);
+
+    EcsArchetype *archetypes = NULL;
+    vec_init(archetypes, 16);
+    ecs->archetypes = archetypes;
+
+    EcsEntityLocation *entity_locations = NULL;
+    vec_init(entity_locations, ECS_PAGE_SIZE);
+    ecs->entity_locations = entity_locations;
+    EcsChunkRef *chunk_refs = NULL;
+    vec_init(chunk_refs, 16);
+    ecs->chunk_refs = chunk_refs;
     return ecs;
 }
 
 void free_ecs(ECS *ecs) {
-    size_t iter = 0;
-    void *item;
-    while (hashmap_iter(ecs->components, &iter, &item)) {
-        ComponentVec cvec = ((struct component_kv*)item)->component_vec;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        ComponentVec cvec = ecs->component_vecs[ind];
         vec_free(cvec.data);
         vec_free(cvec.ind_to_entity);
+        for(size_t page=0;page<vec_size(cvec.entity_to_ind);page++) {
+            free(cvec.entity_to_ind[page]);
+        }
         vec_free(cvec.entity_to_ind);
     }
+    for(EcsArchetype *archetype=vec_begin(ecs->archetypes);archetype<vec_end(ecs->archetypes);archetype++) {
+        for(EcsChunk *chunk=vec_begin(archetype->chunks);chunk<vec_end(archetype->chunks);chunk++) {
+            free(chunk->data);
+        }
+        vec_free(archetype->chunks);
+    }
+    vec_free(ecs->archetypes);
+    vec_free(ecs->entity_locations);
+    vec_free(ecs->chunk_refs);
+    for(size_t ind=0;ind<ecs->number_of_resources;ind++) {
+        free(ecs->resources[ind]);
+    }
     hashmap_free(ecs->components);
     vec_free(ecs->signatures);
-    for(size_t tag_ind=0;tag_ind<ecs->number_of_entities; tag_ind++) {
-        sdsfree(ecs->tags[tag_ind]);
+    vec_free(ecs->generations);
+    for(EcsTag *tag=vec_begin(ecs->tag_table);tag<vec_end(ecs->tag_table);tag++) {
+        if(tag->entities) vec_free(tag->entities);
     }
+    vec_free(ecs->tag_table);
+    hashmap_free(ecs->tag_ids);
     vec_free(ecs->tags);
-    vec_free(ecs->entities_to_spawn);
-    vec_free(ecs->entities_to_kill);
+    vec_free(ecs->tag_slots);
     vec_free(ecs->free_ids);
+    pthread_mutex_destroy(&ecs->spawn_lock);
 
+    if(ecs->jobs) jobs_free(ecs->jobs);
+    for(EcsCommandBuffer *buffer=vec_begin(ecs->command_buffers);buffer<vec_end(ecs->command_buffers);buffer++) {
+        vec_free(buffer->commands);
+        vec_free(buffer->data);
+    }
+    vec_free(ecs->command_buffers);
+    vec_free(ecs->pending_commands);
     for(size_t ind=0;ind<NUM_OF_SYSTEM_TYPES;ind++) {
-        if(ecs->systems[ind]->tags != NULL) {
-            for(sds *tag=vec_begin(ecs->systems[ind]->tags); tag<vec_end(ecs->systems[ind]->tags);tag++) {
-                sdsfree(*tag);
+        if(ecs->schedules[ind]) {
+            for(EcsSystemNode *node=vec_begin(ecs->schedules[ind]);node<vec_end(ecs->schedules[ind]);node++) {
+                vec_free(node->dependents);
             }
-            vec_free(ecs->systems[ind]->tags);
+            vec_free(ecs->schedules[ind]);
+        }
+        for(SystemCallback *system=vec_begin(ecs->systems[ind]);system<vec_end(ecs->systems[ind]);system++) {
+            if(system->tags != NULL) vec_free(system->tags);
+            if(system->gather_entities != NULL) vec_free(system->gather_entities);
+            if(system->gather_columns != NULL) vec_free(system->gather_columns);
         }
         vec_free(ecs->systems[ind]);
     }
@@ -59,86 +140,1047 @@ void free_ecs(ECS *ecs) {
 }
 
 // Components
+ComponentVec *ecs_get_component_vec_by_name(ECS *ecs, char *name) {
+    const struct component_kv *component_kv = hashmap_get(ecs->components, &(struct component_kv){.name=name});
+    if(component_kv == NULL) return NULL;
+    return &ecs->component_vecs[component_kv->id];
+}
+
+// Capacity doubles until count fits
+static void __ecs_component_vec_reserve(ComponentVec *cvec, size_t count) {
+    _vec_metadata *vec_base = vec_get_base(cvec->data);
+    if(count <= vec_base->capacity) return;
+    size_t capacity = vec_base->capacity;
+    while(capacity < count) capacity *= 2;
+    vec_base = realloc(vec_base, sizeof(_vec_metadata)+cvec->size_of_component*capacity);
+    vec_base->capacity = capacity;
+    cvec->data = vec_get_data_ptr(vec_base);
+}
+
+static void *__ecs_component_vec_push(ComponentVec *cvec, const void *component) {
+    __ecs_component_vec_reserve(cvec, vec_size(cvec->data)+1);
+    _vec_metadata *vec_base = vec_get_base(cvec->data);
+    void *dst = cvec->data + cvec->size_of_component*vec_base->size;
+    memcpy(dst, component, cvec->size_of_component);
+    vec_base->size++;
+    return dst;
+}
+
+// Swap and pop, the entity has to have the component
+static void __ecs_component_vec_remove(ComponentVec *cvec, size_t id) {
+    size_t component_to_replace = __ecs_sparse_index(cvec, id);
+    size_t last = vec_size(cvec->data)-1;
+    memcpy(cvec->data+cvec->size_of_component*component_to_replace,
+            cvec->data+cvec->size_of_component*last,
+            cvec->size_of_component
+          );
+    entity_t last_entity = cvec->ind_to_entity[last];
+    __ecs_sparse_index(cvec, __ecs_get_id(last_entity)) = component_to_replace;
+    cvec->ind_to_entity[component_to_replace] = last_entity;
+    vec_pop(cvec->data);
+}
+
+static void __ecs_archetype_add_component(ECS *ecs, size_t component_id, entity_t entity_id, const void *component);
+static size_t __ecs_archetype_move(ECS *ecs, entity_t entity_id, uint32_t new_signature);
+
+static void __ecs_record_command(ECS *ecs, enum ecs_command_type type, entity_t entity_id, size_t component_id, const void *data, size_t size) {
+    EcsCommandBuffer *buffer = &ecs->command_buffers[jobs_pool_worker_index(ecs->jobs)];
+    EcsCommand command = {type, entity_id, component_id, vec_size(buffer->data)};
+    if(data) {
+        size_t capacity = vec_capacity(buffer->data);
+        while(capacity < command.data_offset+size) capacity *= 2;
+        vec_grow(buffer->data, capacity);
+        memcpy(buffer->data+command.data_offset, data, size);
+        vec_get_base(buffer->data)->size += size;
+    }
+    vec_push(buffer->commands, command);
+}
+
+void __ecs_add_component(ECS *ecs, size_t component_id, entity_t entity_id, const void *component) {
+    if(defer_depth > 0) {
+        __ecs_record_command(ecs, ECS_COMMAND_ADD_COMPONENT, entity_id, component_id, component, ecs->component_vecs[component_id].size_of_component);
+        return;
+    }
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        __ecs_archetype_add_component(ecs, component_id, entity_id, component);
+        return;
+    }
+    ComponentVec *cvec = &ecs->component_vecs[component_id];
+    if(ecs_get_signature(ecs, entity_id) & cvec->signature) {
+        memcpy(__ecs_get_component(ecs, component_id, entity_id), component, cvec->size_of_component);
+        return;
+    }
+    __link_entity_with_component(ecs, cvec, entity_id, vec_size(cvec->data));
+    __ecs_component_vec_push(cvec, component);
+}
+
+void __ecs_remove_component(ECS *ecs, size_t component_id, entity_t entity_id) {
+    if(defer_depth > 0) {
+        __ecs_record_command(ecs, ECS_COMMAND_REMOVE_COMPONENT, entity_id, component_id, NULL, 0);
+        return;
+    }
+    ComponentVec *cvec = &ecs->component_vecs[component_id];
+    if(!ecs_is_alive(ecs, entity_id) || !(ecs_get_signature(ecs, entity_id) & cvec->signature)) return;
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        __ecs_archetype_move(ecs, entity_id, ecs_get_signature(ecs, entity_id) & ~cvec->signature);
+        return;
+    }
+    __ecs_component_vec_remove(cvec, __ecs_get_id(entity_id));
+    ecs->signatures[__ecs_get_id(entity_id)] &= ~cvec->signature;
+    ecs->structure_version++;
+}
+
+// Allocates the sparse page holding id if it isn't there yet
+static void __ecs_sparse_reserve(ComponentVec *cvec, entity_t id) {
+    size_t page = id >> ECS_PAGE_BITS;
+    while(vec_size(cvec->entity_to_ind) <= page) {
+        size_t *empty = NULL;
+        vec_push(cvec->entity_to_ind, empty);
+    }
+    if(cvec->entity_to_ind[page] == NULL) cvec->entity_to_ind[page] = malloc(sizeof(size_t)*ECS_PAGE_SIZE);
+}
+
 void __link_entity_with_component(ECS *ecs, ComponentVec *cvec, entity_t entity_id, size_t component) {
-    cvec->entity_to_ind[__ecs_get_id(entity_id)] = component;
-    cvec->ind_to_entity[component]=__ecs_get_id(entity_id);
+    __ecs_sparse_reserve(cvec, __ecs_get_id(entity_id));
+    if(component >= vec_capacity(cvec->ind_to_entity)) vec_grow(cvec->ind_to_entity, 2*(component+1));
+    __ecs_sparse_index(cvec, __ecs_get_id(entity_id)) = component;
+    cvec->ind_to_entity[component]=entity_id;
     ecs->signatures[__ecs_get_id(entity_id)] |= cvec->signature;
+    ecs->structure_version++;
+}
+
+// Returns the vec with the fewest components among the ones in mask, queries only have to walk its dense array
+ComponentVec *__ecs_smallest_component_vec(ECS *ecs, uint32_t mask) {
+    ComponentVec *smallest = NULL;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        ComponentVec *cvec = &ecs->component_vecs[ind];
+        if(!(mask & cvec->signature)) continue;
+        if(smallest==NULL || vec_size(cvec->data) < vec_size(smallest->data)) smallest = cvec;
+    }
+    return smallest;
+}
+
+static void __ecs_swap_components(ComponentVec *cvec, size_t a, size_t b) {
+    if(a==b) return;
+    unsigned char *ca = cvec->data+cvec->size_of_component*a;
+    unsigned char *cb = cvec->data+cvec->size_of_component*b;
+    for(size_t byte=0;byte<cvec->size_of_component;byte++) {
+        unsigned char tmp = ca[byte];
+        ca[byte] = cb[byte];
+        cb[byte] = tmp;
+    }
+    size_t handle_a = cvec->ind_to_entity[a];
+    size_t entity_a = __ecs_get_id(handle_a);
+    size_t entity_b = __ecs_get_id(cvec->ind_to_entity[b]);
+    cvec->ind_to_entity[a] = cvec->ind_to_entity[b];
+    cvec->ind_to_entity[b] = handle_a;
+    __ecs_sparse_index(cvec, entity_a) = b;
+    __ecs_sparse_index(cvec, entity_b) = a;
+}
+
+// Moves entities matching mask to the front of every vec in mask, in the same order.
+// Returns how many there are. Already grouped vecs aren't touched, so it's cheap to call every frame.
+// A vec belongs to the first group that orders it, so two overlapping groups can't keep undoing each
+// other's order; returns -1 if a vec in mask is owned by a different group.
+size_t __ecs_group_components(ECS *ecs, uint32_t mask) {
+    ComponentVec *cvecs[MAX_COMPONENTS];
+    size_t n_of_cvecs = 0;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        if(mask & ecs->component_vecs[ind].signature) cvecs[n_of_cvecs++] = &ecs->component_vecs[ind];
+    }
+    if(n_of_cvecs==1) return vec_size(cvecs[0]->data);
+    for(size_t c_ind=0;c_ind<n_of_cvecs;c_ind++) {
+        if(cvecs[c_ind]->group_mask != 0 && cvecs[c_ind]->group_mask != mask) return -1;
+    }
+    for(size_t c_ind=0;c_ind<n_of_cvecs;c_ind++) cvecs[c_ind]->group_mask = mask;
+
+    ComponentVec *smallest = __ecs_smallest_component_vec(ecs, mask);
+    size_t grouped = 0;
+    bool swapped = false;
+    for(size_t ind=0;ind<vec_size(smallest->data);ind++) {
+        size_t entity_id = __ecs_get_id(smallest->ind_to_entity[ind]);
+        if((ecs->signatures[entity_id] & mask) != mask) continue;
+        for(size_t c_ind=0;c_ind<n_of_cvecs;c_ind++) {
+            size_t component = __ecs_sparse_index(cvecs[c_ind], entity_id);
+            if(component==grouped) continue;
+            __ecs_swap_components(cvecs[c_ind], component, grouped);
+            swapped = true;
+        }
+        grouped++;
+    }
+    if(swapped) ecs->structure_version++;
+    return grouped;
+}
+
+// Archetypes
+#define __ecs_align16(bytes) (((bytes)+15) & ~(size_t)15)
+
+static size_t __ecs_new_archetype(ECS *ecs, uint32_t signature) {
+    EcsArchetype archetype = {0};
+    archetype.signature = signature;
+
+    size_t row_bytes = sizeof(size_t);
+    size_t n_of_columns = 1;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        if(!(signature & ecs->component_vecs[ind].signature)) continue;
+        row_bytes += ecs->component_vecs[ind].size_of_component;
+        n_of_columns++;
+    }
+    // Every column is padded to 16 bytes
+    size_t capacity = (ECS_CHUNK_SIZE - 16*n_of_columns) / row_bytes;
+    if(capacity==0) capacity = 1;
+    archetype.chunk_capacity = capacity;
+
+    size_t offset = __ecs_align16(sizeof(size_t)*capacity);
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        if(!(signature & ecs->component_vecs[ind].signature)) continue;
+        archetype.column_offsets[ind] = offset;
+        offset += __ecs_align16(ecs->component_vecs[ind].size_of_component*capacity);
+    }
+    archetype.chunk_bytes = offset;
+
+    EcsChunk *chunks = NULL;
+    vec_init(chunks, 4);
+    archetype.chunks = chunks;
+    vec_push(ecs->archetypes, archetype);
+    return vec_size(ecs->archetypes)-1;
+}
+
+static size_t __ecs_find_archetype(ECS *ecs, uint32_t signature) {
+    for(size_t ind=0;ind<vec_size(ecs->archetypes);ind++) {
+        if(ecs->archetypes[ind].signature == signature) return ind;
+    }
+    return __ecs_new_archetype(ecs, signature);
+}
+
+#define __ecs_archetype_entities(archetype, row) ((size_t*)(archetype)->chunks[(row)/(archetype)->chunk_capacity].data)
+#define __ecs_archetype_entity(archetype, row) __ecs_archetype_entities(archetype, row)[(row)%(archetype)->chunk_capacity]
+
+static inline void *__ecs_archetype_component(ECS *ecs, EcsArchetype *archetype, size_t component_id, size_t row) {
+    EcsChunk *chunk = &archetype->chunks[row/archetype->chunk_capacity];
+    return chunk->data + archetype->column_offsets[component_id] + ecs->component_vecs[component_id].size_of_component*(row%archetype->chunk_capacity);
+}
+
+// Index of the last chunk starting at or before ptr, -1 if there is none
+static size_t __ecs_find_chunk_ref(ECS *ecs, const void *ptr) {
+    size_t low = 0, high = vec_size(ecs->chunk_refs);
+    while(low < high) {
+        size_t mid = low + (high-low)/2;
+        if((const unsigned char*)ecs->chunk_refs[mid].data <= (const unsigned char*)ptr) low = mid+1;
+        else high = mid;
+    }
+    return low-1;
+}
+
+static size_t __ecs_archetype_push_row(ECS *ecs, size_t archetype_ind, entity_t entity_id) {
+    EcsArchetype *archetype = &ecs->archetypes[archetype_ind];
+    if(archetype->size == vec_size(archetype->chunks)*archetype->chunk_capacity) {
+        EcsChunk chunk = {malloc(archetype->chunk_bytes), 0};
+        vec_push(archetype->chunks, chunk);
+        EcsChunkRef ref = {chunk.data, archetype_ind, vec_size(archetype->chunks)-1};
+        size_t at = __ecs_find_chunk_ref(ecs, chunk.data)+1;
+        vec_push(ecs->chunk_refs, ref);
+        memmove(&ecs->chunk_refs[at+1], &ecs->chunk_refs[at], sizeof(EcsChunkRef)*(vec_size(ecs->chunk_refs)-1-at));
+        ecs->chunk_refs[at] = ref;
+    }
+    size_t row = archetype->size++;
+    archetype->chunks[row/archetype->chunk_capacity].count++;
+    __ecs_archetype_entity(archetype, row) = entity_id;
+    return row;
+}
+
+// Swap and pop, the last row of the archetype takes the place of the removed one
+static void __ecs_archetype_remove_row(ECS *ecs, size_t archetype_ind, size_t row) {
+    EcsArchetype *archetype = &ecs->archetypes[archetype_ind];
+    size_t last = archetype->size-1;
+    if(row != last) {
+        for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+            if(!(archetype->signature & ecs->component_vecs[ind].signature)) continue;
+            memcpy(__ecs_archetype_component(ecs, archetype, ind, row),
+                    __ecs_archetype_component(ecs, archetype, ind, last),
+                    ecs->component_vecs[ind].size_of_component
+                  );
+        }
+        size_t last_entity = __ecs_archetype_entity(archetype, last);
+        __ecs_archetype_entity(archetype, row) = last_entity;
+        ecs->entity_locations[__ecs_get_id(last_entity)].chunk = row/archetype->chunk_capacity;
+        ecs->entity_locations[__ecs_get_id(last_entity)].index = row%archetype->chunk_capacity;
+    }
+    archetype->chunks[last/archetype->chunk_capacity].count--;
+    archetype->size--;
+    // Rows are dense so only the trailing chunk can empty. It's released once the chunk before it is half empty,
+    // a row going back and forth over the boundary doesn't allocate every time. The first chunk stays.
+    size_t n_of_chunks = vec_size(archetype->chunks);
+    if(n_of_chunks > 1 && archetype->size + archetype->chunk_capacity/2 <= (n_of_chunks-1)*archetype->chunk_capacity) {
+        void *data = archetype->chunks[n_of_chunks-1].data;
+        vec_erase(ecs->chunk_refs, __ecs_find_chunk_ref(ecs, data), 1);
+        vec_pop(archetype->chunks);
+        free(data);
+    }
+}
+
+static void __ecs_archetype_add_component(ECS *ecs, size_t component_id, entity_t entity_id, const void *component) {
+    size_t id = __ecs_get_id(entity_id);
+    uint32_t old_signature = ecs->signatures[id];
+    uint32_t new_signature = old_signature | ecs->component_vecs[component_id].signature;
+    EcsEntityLocation old_location = ecs->entity_locations[id];
+    // The location is stale while the entity has no components
+    size_t old_row = old_signature ? old_location.chunk*ecs->archetypes[old_location.archetype].chunk_capacity + old_location.index : 0;
+
+    size_t new_archetype_ind;
+    if(old_signature == 0) {
+        new_archetype_ind = __ecs_find_archetype(ecs, new_signature);
+    }else if(ecs->archetypes[old_location.archetype].add_edges[component_id] != 0) {
+        new_archetype_ind = ecs->archetypes[old_location.archetype].add_edges[component_id]-1;
+    }else {
+        new_archetype_ind = __ecs_find_archetype(ecs, new_signature);
+        ecs->archetypes[old_location.archetype].add_edges[component_id] = new_archetype_ind+1;
+    }
+
+    if(new_archetype_ind == old_location.archetype && old_signature != 0) {
+        memcpy(__ecs_archetype_component(ecs, &ecs->archetypes[new_archetype_ind], component_id, old_row), component, ecs->component_vecs[component_id].size_of_component);
+        return;
+    }
+
+    EcsArchetype *new_archetype = &ecs->archetypes[new_archetype_ind];
+    size_t new_row = __ecs_archetype_push_row(ecs, new_archetype_ind, entity_id);
+    if(old_signature != 0) {
+        EcsArchetype *old_archetype = &ecs->archetypes[old_location.archetype];
+        for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+            if(!(old_signature & ecs->component_vecs[ind].signature)) continue;
+            memcpy(__ecs_archetype_component(ecs, new_archetype, ind, new_row),
+                    __ecs_archetype_component(ecs, old_archetype, ind, old_row),
+                    ecs->component_vecs[ind].size_of_component
+                  );
+        }
+        __ecs_archetype_remove_row(ecs, old_location.archetype, old_row);
+    }
+    memcpy(__ecs_archetype_component(ecs, new_archetype, component_id, new_row), component, ecs->component_vecs[component_id].size_of_component);
+
+    ecs->entity_locations[id] = (EcsEntityLocation){new_archetype_ind, new_row/new_archetype->chunk_capacity, new_row%new_archetype->chunk_capacity};
+    ecs->signatures[id] = new_signature;
+    ecs->structure_version++;
+}
+
+// Moves the entity's row to the archetype of new_signature, components of both are copied and new ones are left
+// for the caller to fill. Returns the new row, -1 for an empty signature.
+static size_t __ecs_archetype_move(ECS *ecs, entity_t entity_id, uint32_t new_signature) {
+    size_t id = __ecs_get_id(entity_id);
+    uint32_t old_signature = ecs->signatures[id];
+    EcsEntityLocation old_location = ecs->entity_locations[id];
+    size_t old_row = old_signature ? old_location.chunk*ecs->archetypes[old_location.archetype].chunk_capacity + old_location.index : 0;
+    if(old_signature == new_signature) return old_signature ? old_row : -1;
+
+    if(new_signature == 0) {
+        __ecs_archetype_remove_row(ecs, old_location.archetype, old_row);
+        ecs->signatures[id] = 0;
+        ecs->structure_version++;
+        return -1;
+    }
+    size_t new_archetype_ind = __ecs_find_archetype(ecs, new_signature);
+    EcsArchetype *new_archetype = &ecs->archetypes[new_archetype_ind];
+    size_t new_row = __ecs_archetype_push_row(ecs, new_archetype_ind, entity_id);
+    if(old_signature != 0) {
+        EcsArchetype *old_archetype = &ecs->archetypes[old_location.archetype];
+        for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+            if(!(old_signature & new_signature & ecs->component_vecs[ind].signature)) continue;
+            memcpy(__ecs_archetype_component(ecs, new_archetype, ind, new_row),
+                    __ecs_archetype_component(ecs, old_archetype, ind, old_row),
+                    ecs->component_vecs[ind].size_of_component
+                  );
+        }
+        __ecs_archetype_remove_row(ecs, old_location.archetype, old_row);
+    }
+    ecs->entity_locations[id] = (EcsEntityLocation){new_archetype_ind, new_row/new_archetype->chunk_capacity, new_row%new_archetype->chunk_capacity};
+    ecs->signatures[id] = new_signature;
+    ecs->structure_version++;
+    return new_row;
+}
+
+static entity_t __ecs_archetype_get_entity_id(ECS *ecs, size_t component_id, void *component_ptr) {
+    size_t ref_ind = __ecs_find_chunk_ref(ecs, component_ptr);
+    if(ref_ind == (size_t)-1) return -1;
+    EcsChunkRef *ref = &ecs->chunk_refs[ref_ind];
+    EcsArchetype *archetype = &ecs->archetypes[ref->archetype];
+    if(!(archetype->signature & ecs->component_vecs[component_id].signature)) return -1;
+    EcsChunk *chunk = &archetype->chunks[ref->chunk];
+    size_t size_of_component = ecs->component_vecs[component_id].size_of_component;
+    void *column = chunk->data + archetype->column_offsets[component_id];
+    if(component_ptr < column || component_ptr >= column + size_of_component*chunk->count) return -1;
+    return ((size_t*)chunk->data)[(component_ptr-column)/size_of_component];
+}
+
+// Resources
+size_t __ecs_register_resource(ECS *ecs, size_t size_of_resource, const void *resource) {
+    if(ecs->number_of_resources >= MAX_RESOURCES) return -1;
+    void *copy = malloc(size_of_resource);
+    memcpy(copy, resource, size_of_resource);
+    ecs->resources[ecs->number_of_resources] = copy;
+    return ecs->number_of_resources++;
 }
 
 // Entities
-entity_t new_entity(ECS *ecs) {
-    entity_t new_id = ecs->number_of_entities++;
+// Grows every entity indexed array by whole pages until id fits, new slots are zeroed
+static void __ecs_reserve_entity(ECS *ecs, entity_t id) {
+    if(id < vec_size(ecs->signatures)) return;
+    size_t old_size = vec_size(ecs->signatures);
+    size_t new_size = ((size_t)id+ECS_PAGE_SIZE) & ~(size_t)ECS_PAGE_MASK;
+    size_t capacity = vec_capacity(ecs->signatures);
+    while(capacity < new_size) capacity *= 2;
+    vec_grow(ecs->signatures, capacity);
+    vec_grow(ecs->generations, capacity);
+    vec_grow(ecs->tags, capacity);
+    vec_grow(ecs->tag_slots, capacity);
+    vec_grow(ecs->entity_locations, capacity);
+    memset(ecs->signatures+old_size, 0, sizeof(*ecs->signatures)*(new_size-old_size));
+    memset(ecs->generations+old_size, 0, sizeof(*ecs->generations)*(new_size-old_size));
+    memset(ecs->tags+old_size, 0, sizeof(*ecs->tags)*(new_size-old_size));
+    memset(ecs->tag_slots+old_size, 0, sizeof(*ecs->tag_slots)*(new_size-old_size));
+    memset(ecs->entity_locations+old_size, 0, sizeof(*ecs->entity_locations)*(new_size-old_size));
+    vec_get_base(ecs->signatures)->size = new_size;
+    vec_get_base(ecs->generations)->size = new_size;
+    vec_get_base(ecs->tags)->size = new_size;
+    vec_get_base(ecs->tag_slots)->size = new_size;
+    vec_get_base(ecs->entity_locations)->size = new_size;
+}
+
+// free_ids holds bare indices, the handle carries the generation erasing left there.
+// Every index below number_of_entities+retired_ids is alive, free or retired.
+static entity_t __ecs_next_id(ECS *ecs) {
+    entity_t new_id = ecs->number_of_entities + ecs->retired_ids;
+    ecs->number_of_entities++;
     if(vec_size(ecs->free_ids) > 0) {
-        //new_id = (1<<24) | ecs->free_ids[vec_size(ecs->free_ids)-1];
         new_id =ecs->free_ids[vec_size(ecs->free_ids)-1];
         vec_pop(ecs->free_ids);
     }
     return new_id;
 }
 
+// Takes the id now so the system can record components for it, the arrays only grow when the spawn is applied.
+// The tag name is copied into the command and interned by the flush, the tag table and string pool aren't locked.
+static entity_t __ecs_spawn_deferred(ECS *ecs, const char *tag) {
+    pthread_mutex_lock(&ecs->spawn_lock);
+    entity_t new_id = __ecs_next_id(ecs);
+    uint8_t generation = new_id < vec_size(ecs->generations) ? ecs->generations[new_id] : 0;
+    pthread_mutex_unlock(&ecs->spawn_lock);
+    entity_t entity_id = __ecs_make_handle(new_id, generation);
+    __ecs_record_command(ecs, ECS_COMMAND_SPAWN, entity_id, tag != NULL, tag, tag ? strlen(tag)+1 : 0);
+    return entity_id;
+}
+
+entity_t new_entity(ECS *ecs) {
+    if(defer_depth > 0) return __ecs_spawn_deferred(ecs, NULL);
+    entity_t new_id = __ecs_next_id(ecs);
+    __ecs_reserve_entity(ecs, new_id);
+    return __ecs_make_handle(new_id, ecs->generations[new_id]);
+}
+
 entity_t new_entity_with_tag(ECS *ecs, char *tag) {
-    entity_t id = new_entity(ecs);
-    ecs->tags[id] = sdsnew(tag);
-    return id;
+    if(defer_depth > 0) return __ecs_spawn_deferred(ecs, tag);
+    entity_t entity_id = new_entity(ecs);
+    ecs_set_tag(ecs, entity_id, ecs_tag_id(ecs, tag));
+    return entity_id;
+}
+
+void *__ecs_iter_components(ECS *ecs, size_t component_id) {
+    assert(ecs->storage == ECS_STORAGE_SPARSE_SET && "ecs_iter_components needs sparse set storage, use a batch system");
+    return ecs->component_vecs[component_id].data;
 }
 
-entity_t __ecs_get_entity_id(ECS *ecs, ComponentVec *cvec, void *component_ptr) {
+entity_t __ecs_get_entity_id(ECS *ecs, size_t component_id, void *component_ptr) {
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) return __ecs_archetype_get_entity_id(ecs, component_id, component_ptr);
+    ComponentVec *cvec = &ecs->component_vecs[component_id];
     return cvec->ind_to_entity[(component_ptr-cvec->data)/cvec->size_of_component];
 }
 
+// Stale handles are ignored, so killing the same entity twice is harmless
 void __ecs_erase_entity(ECS *ecs, entity_t entity_id) {
-    size_t iter = 0;
-    void *item;
-    while (hashmap_iter(ecs->components, &iter, &item)) {
-        const struct component_kv *component_kv= item;
-        if(ecs_get_signature(ecs, entity_id) & component_kv->component_vec.signature) {
-            ComponentVec cvec = component_kv->component_vec;
-            size_t component_to_replace = cvec.entity_to_ind[__ecs_get_id(entity_id)];
-            memcpy(cvec.data+cvec.size_of_component*component_to_replace,
-                    cvec.data+cvec.size_of_component*(vec_size(cvec.data)-1),
-                    cvec.size_of_component
-                  );
-            entity_t last_entity = cvec.ind_to_entity[vec_size(cvec.data)-1];
-            cvec.entity_to_ind[last_entity] = component_to_replace;
-            cvec.ind_to_entity[component_to_replace] = last_entity;
-            vec_pop(cvec.data);
+    if(!ecs_is_alive(ecs, entity_id)) return;
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        if(ecs_get_signature(ecs, entity_id) != 0) {
+            EcsEntityLocation location = ecs->entity_locations[__ecs_get_id(entity_id)];
+            __ecs_archetype_remove_row(ecs, location.archetype, location.chunk*ecs->archetypes[location.archetype].chunk_capacity + location.index);
+        }
+    }else {
+        for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+            if(ecs_get_signature(ecs, entity_id) & ecs->component_vecs[ind].signature) {
+                __ecs_component_vec_remove(&ecs->component_vecs[ind], __ecs_get_id(entity_id));
+            }
         }
     }
     ecs->signatures[__ecs_get_id(entity_id)] = 0;
-    if(ecs->tags[__ecs_get_id(entity_id)]) sdsclear(ecs->tags[__ecs_get_id(entity_id)]);
+    ecs->structure_version++;
+    ecs_set_tag(ecs, entity_id, ECS_NO_TAG);
     ecs->number_of_entities--;
-    vec_push(ecs->free_ids, entity_id);
+    // The last generation is never handed out, reusing the index after it would wrap back to handles already given
+    if(++ecs->generations[__ecs_get_id(entity_id)] == UINT8_MAX) ecs->retired_ids++;
+    else vec_push(ecs->free_ids, __ecs_get_id(entity_id));
+}
+
+void ecs_kill_entity(ECS *ecs, entity_t entity_id) {
+    if(defer_depth > 0) {
+        __ecs_record_command(ecs, ECS_COMMAND_KILL, entity_id, 0, NULL, 0);
+        return;
+    }
+    __ecs_erase_entity(ecs, entity_id);
+}
+
+// Tags
+ecs_tag_t ecs_lookup_tag(ECS *ecs, const char *tag) {
+    const struct tag_kv *tag_kv = hashmap_get(ecs->tag_ids, &(struct tag_kv){.name=tag});
+    return tag_kv ? tag_kv->id : ECS_NO_TAG;
+}
+
+ecs_tag_t ecs_tag_id(ECS *ecs, const char *tag) {
+    ecs_tag_t id = ecs_lookup_tag(ecs, tag);
+    if(id != ECS_NO_TAG) return id;
+    EcsTag new_tag = {intern_string(tag), NULL};
+    vec_init(new_tag.entities, 16);
+    id = vec_size(ecs->tag_table);
+    vec_push(ecs->tag_table, new_tag);
+    // The key is the pooled copy, it outlives the table
+    hashmap_set(ecs->tag_ids, &(struct tag_kv){new_tag.name, id});
+    return id;
+}
+
+// Swap removes from the old tag's entities, so both sides are O(1)
+void ecs_set_tag(ECS *ecs, entity_t entity_id, ecs_tag_t tag) {
+    size_t id = __ecs_get_id(entity_id);
+    ecs_tag_t old_tag = ecs->tags[id];
+    if(old_tag == tag) return;
+    if(old_tag != ECS_NO_TAG) {
+        entity_t *entities = ecs->tag_table[old_tag].entities;
+        entity_t last_entity = entities[vec_size(entities)-1];
+        entities[ecs->tag_slots[id]] = last_entity;
+        ecs->tag_slots[__ecs_get_id(last_entity)] = ecs->tag_slots[id];
+        vec_pop(ecs->tag_table[old_tag].entities);
+    }
+    ecs->tags[id] = tag;
+    if(tag != ECS_NO_TAG) {
+        ecs->tag_slots[id] = vec_size(ecs->tag_table[tag].entities);
+        vec_push(ecs->tag_table[tag].entities, entity_id);
+    }
+}
+
+entity_t __ecs_find_entity_with_tag(ECS *ecs, const char *tag) {
+    ecs_tag_t id = ecs_lookup_tag(ecs, tag);
+    if(id == ECS_NO_TAG || vec_size(ecs->tag_table[id].entities) == 0) return ECS_NULL_ENTITY;
+    return ecs->tag_table[id].entities[0];
 }
+
 // Systems
-void ecs_call_system(ECS *ecs, enum system_type system_type) {
-    for(SystemCallback *func=vec_begin(ecs->systems[system_type]);func<vec_end(ecs->systems[system_type]);func++) {
-        if(func->tags!=NULL) {
-            for(size_t n=0;n<MAX_ENTITIES; n++) {
-                if(ecs->tags[n]==0) continue;
-                for(sds *tag=vec_begin(func->tags);tag<vec_end(func->tags);tag++) {
-                    if(strcmp(ecs->tags[n], *tag)==0) {
-                        func->callback(ecs, n);
-                        break;
-                    }
+// Returns the number of entities callback ran on
+size_t __ecs_call_for_each(ECS *ecs, uint32_t mask, component_func_t callback) {
+    size_t calls = 0;
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        for(size_t a_ind=0;a_ind<vec_size(ecs->archetypes);a_ind++) {
+            if((ecs->archetypes[a_ind].signature & mask) != mask) continue;
+            for(size_t c_ind=0;c_ind<vec_size(ecs->archetypes[a_ind].chunks);c_ind++) {
+                for(size_t ind=0;ind<ecs->archetypes[a_ind].chunks[c_ind].count;ind++) {
+                    callback(ecs, ((size_t*)ecs->archetypes[a_ind].chunks[c_ind].data)[ind]);
+                    calls++;
                 }
             }
-            continue;
-        }else if(func->entity_mask!=0) {
-            for(size_t n=0;n<MAX_ENTITIES; n++) {
-                if((ecs->signatures[n] & func->entity_mask) == func->entity_mask) {
-                    func->callback(ecs, n);
+        }
+        return calls;
+    }
+    // Size is re-read every iteration, callbacks may add components to this vec
+    ComponentVec *cvec = __ecs_smallest_component_vec(ecs, mask);
+    for(size_t n=0;n<vec_size(cvec->data); n++) {
+        entity_t entity_id = cvec->ind_to_entity[n];
+        if((ecs->signatures[__ecs_get_id(entity_id)] & mask) == mask) {
+            callback(ecs, entity_id);
+            calls++;
+        }
+    }
+    return calls;
+}
+
+// Batch over vecs another group orders, matching components are copied out and written back after the call
+static size_t __ecs_call_gathered_batch(ECS *ecs, SystemCallback *func) {
+    ComponentVec *smallest = __ecs_smallest_component_vec(ecs, func->entity_mask);
+    vec_init(func->gather_entities, 64);
+    vec_get_base(func->gather_entities)->size = 0;
+    for(size_t ind=0;ind<vec_size(smallest->data);ind++) {
+        size_t handle = smallest->ind_to_entity[ind];
+        if((ecs->signatures[__ecs_get_id(handle)] & func->entity_mask) == func->entity_mask) vec_push(func->gather_entities, handle);
+    }
+    size_t count = vec_size(func->gather_entities);
+    if(count==0) return 0;
+
+    EcsBatch batch = {0};
+    batch.count = count;
+    batch.entities = func->gather_entities;
+    // Columns are packed into one buffer, each starting 16-byte aligned
+    size_t offsets[MAX_COMPONENTS];
+    size_t total = 0;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        if(!(func->entity_mask & ecs->component_vecs[ind].signature)) continue;
+        offsets[ind] = total;
+        total += (ecs->component_vecs[ind].size_of_component*count + 15) & ~(size_t)15;
+    }
+    vec_init(func->gather_columns, total);
+    vec_grow(func->gather_columns, total);
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        ComponentVec *cvec = &ecs->component_vecs[ind];
+        if(!(func->entity_mask & cvec->signature)) continue;
+        unsigned char *column = func->gather_columns + offsets[ind];
+        for(size_t row=0;row<count;row++) {
+            size_t component = __ecs_sparse_index(cvec, __ecs_get_id(batch.entities[row]));
+            memcpy(column+cvec->size_of_component*row, cvec->data+cvec->size_of_component*component, cvec->size_of_component);
+        }
+        batch.components[ind] = column;
+    }
+
+    func->batch_callback(ecs, &batch);
+
+    // Structural changes are deferred while systems run, so the dense indices still hold
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        ComponentVec *cvec = &ecs->component_vecs[ind];
+        if(!(func->entity_mask & cvec->signature)) continue;
+        unsigned char *column = batch.components[ind];
+        for(size_t row=0;row<count;row++) {
+            size_t component = __ecs_sparse_index(cvec, __ecs_get_id(batch.entities[row]));
+            memcpy(cvec->data+cvec->size_of_component*component, column+cvec->size_of_component*row, cvec->size_of_component);
+        }
+    }
+    return count;
+}
+
+// Sparse sets get one batch over the grouped vecs, archetypes one batch per chunk. Returns the summed batch sizes.
+size_t __ecs_call_batches(ECS *ecs, SystemCallback *func) {
+    EcsBatch batch = {0};
+    size_t entities = 0;
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        for(size_t a_ind=0;a_ind<vec_size(ecs->archetypes);a_ind++) {
+            EcsArchetype *archetype = &ecs->archetypes[a_ind];
+            if((archetype->signature & func->entity_mask) != func->entity_mask) continue;
+            for(size_t c_ind=0;c_ind<vec_size(archetype->chunks);c_ind++) {
+                EcsChunk *chunk = &archetype->chunks[c_ind];
+                if(chunk->count==0) continue;
+                batch.count = chunk->count;
+                batch.entities = chunk->data;
+                for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+                    if(!(func->entity_mask & ecs->component_vecs[ind].signature)) continue;
+                    batch.components[ind] = chunk->data + archetype->column_offsets[ind];
                 }
+                func->batch_callback(ecs, &batch);
+                entities += batch.count;
+                archetype = &ecs->archetypes[a_ind];
+            }
+        }
+        return entities;
+    }
+    if(func->grouped_version != ecs->structure_version) {
+        func->grouped_count = __ecs_group_components(ecs, func->entity_mask);
+        func->grouped_version = ecs->structure_version;
+    }
+    if(func->grouped_count == (size_t)-1) return __ecs_call_gathered_batch(ecs, func);
+    batch.count = func->grouped_count;
+    if(batch.count==0) return 0;
+    for(size_t ind=0;ind<ecs->number_of_components;ind++) {
+        ComponentVec *cvec = &ecs->component_vecs[ind];
+        if(!(func->entity_mask & cvec->signature)) continue;
+        batch.components[ind] = cvec->data;
+        batch.entities = cvec->ind_to_entity;
+    }
+    func->batch_callback(ecs, &batch);
+    return batch.count;
+}
+
+#define ECS_PARALLEL_GRAIN 64
+
+struct parallel_range {
+    ECS *ecs;
+    SystemCallback *func;
+    size_t *entities;
+    size_t count;
+    bool check_signature;
+    size_t calls;
+};
+
+static void __ecs_parallel_range_job(void *data) {
+    struct parallel_range *range = data;
+    uint32_t mask = range->func->entity_mask;
+    defer_depth++;
+    for(size_t ind=0;ind<range->count;ind++) {
+        size_t entity_id = range->entities[ind];
+        if(range->check_signature && (range->ecs->signatures[__ecs_get_id(entity_id)] & mask) != mask) continue;
+        range->func->callback(range->ecs, entity_id);
+        range->calls++;
+    }
+    defer_depth--;
+}
+
+// Archetypes are split per chunk, sparse sets into ranges of the smallest vec's dense array
+static size_t __ecs_call_parallel(ECS *ecs, SystemCallback *func) {
+    struct parallel_range *ranges = NULL;
+    vec_init(ranges, 16);
+    if(ecs->storage == ECS_STORAGE_ARCHETYPE) {
+        for(EcsArchetype *archetype=vec_begin(ecs->archetypes);archetype<vec_end(ecs->archetypes);archetype++) {
+            if((archetype->signature & func->entity_mask) != func->entity_mask) continue;
+            for(EcsChunk *chunk=vec_begin(archetype->chunks);chunk<vec_end(archetype->chunks);chunk++) {
+                if(chunk->count==0) continue;
+                struct parallel_range range = {ecs, func, chunk->data, chunk->count, false, 0};
+                vec_push(ranges, range);
+            }
+        }
+    }else {
+        ComponentVec *cvec = __ecs_smallest_component_vec(ecs, func->entity_mask);
+        size_t n_of_threads = ecs->jobs ? ecs->jobs->n_of_queues : 1;
+        size_t grain = vec_size(cvec->data)/(n_of_threads*4)+1;
+        if(grain < ECS_PARALLEL_GRAIN) grain = ECS_PARALLEL_GRAIN;
+        for(size_t begin=0;begin<vec_size(cvec->data);begin+=grain) {
+            size_t count = vec_size(cvec->data)-begin < grain ? vec_size(cvec->data)-begin : grain;
+            struct parallel_range range = {ecs, func, cvec->ind_to_entity+begin, count, true, 0};
+            vec_push(ranges, range);
+        }
+    }
+
+    if(ecs->jobs == NULL) {
+        for(struct parallel_range *range=vec_begin(ranges);range<vec_end(ranges);range++) {
+            __ecs_parallel_range_job(range);
+        }
+    }else {
+        atomic_size_t counter;
+        atomic_init(&counter, 0);
+        for(struct parallel_range *range=vec_begin(ranges);range<vec_end(ranges);range++) {
+            jobs_push_counted(ecs->jobs, __ecs_parallel_range_job, range, &counter);
+        }
+        jobs_wait_counter(ecs->jobs, &counter);
+    }
+    size_t calls = 0;
+    for(struct parallel_range *range=vec_begin(ranges);range<vec_end(ranges);range++) {
+        calls += range->calls;
+    }
+    vec_free(ranges);
+    return calls;
+}
+
+static void __ecs_profile_record(EcsProfile *profile, uint64_t start, size_t entities) {
+    EcsProfileSample *sample = &profile->samples[profile->next];
+    sample->start = start;
+    sample->duration = __ecs_now_ns() - start;
+    sample->entities = entities;
+    sample->thread = jobs_worker_index();
+    profile->next = (profile->next+1) % ECS_PROFILE_WINDOW;
+    if(profile->count < ECS_PROFILE_WINDOW) profile->count++;
+}
+
+static void __ecs_run_system(ECS *ecs, SystemCallback *func) {
+    uint64_t start = ecs->profiling ? __ecs_now_ns() : 0;
+    size_t entities = 0;
+    defer_depth++;
+    if(func->parallel) {
+        entities = __ecs_call_parallel(ecs, func);
+    }else if(func->batch_callback!=NULL) {
+        entities = __ecs_call_batches(ecs, func);
+    }else if(func->tags!=NULL) {
+        for(ecs_tag_t *tag=vec_begin(func->tags);tag<vec_end(func->tags);tag++) {
+            // Indexed every call, the callback may tag new entities and move the table
+            for(size_t n=0;n<vec_size(ecs->tag_table[*tag].entities);n++) {
+                func->callback(ecs, ecs->tag_table[*tag].entities[n]);
+                entities++;
             }
-        }else {
-            func->callback(ecs, -1);
+        }
+    }else if(func->entity_mask!=0) {
+        entities = __ecs_call_for_each(ecs, func->entity_mask, func->callback);
+    }else {
+        func->callback(ecs, -1);
+    }
+    defer_depth--;
+    if(ecs->profiling) __ecs_profile_record(&func->profile, start, entities);
+}
+
+void ecs_set_thread_count(ECS *ecs, size_t n_of_threads) {
+    if(ecs->jobs) jobs_free(ecs->jobs);
+    ecs->jobs = NULL;
+    // The calling thread is one of them
+    if(n_of_threads > 1) ecs->jobs = jobs_init(n_of_threads-1);
+    while(vec_size(ecs->command_buffers) < n_of_threads) {
+        vec_push(ecs->command_buffers, __ecs_new_command_buffer());
+    }
+}
+
+// Sparse sets sort component changes by type so additions are applied per ComponentVec.
+// Archetypes only sort by command, an entity's consecutive additions are applied in one move.
+#define ECS_COMMAND_KEYS (ECS_COMMAND_TYPES*MAX_COMPONENTS)
+
+static size_t __ecs_command_key(const EcsCommand *command, bool by_component) {
+    size_t key = command->type*MAX_COMPONENTS;
+    if(by_component && (command->type == ECS_COMMAND_ADD_COMPONENT || command->type == ECS_COMMAND_REMOVE_COMPONENT)) key += command->component_id;
+    return key;
+}
+
+// Additions of one component type, the dense arrays grow once for the whole run
+static void __ecs_apply_component_adds(ECS *ecs, EcsPendingCommand *begin, EcsPendingCommand *end) {
+    ComponentVec *cvec = &ecs->component_vecs[begin->command.component_id];
+    size_t count = vec_size(cvec->data) + (end-begin);
+    __ecs_component_vec_reserve(cvec, count);
+    if(count > vec_capacity(cvec->ind_to_entity)) vec_grow(cvec->ind_to_entity, vec_capacity(cvec->data));
+    for(EcsPendingCommand *pending=begin;pending<end;pending++) {
+        entity_t entity_id = pending->command.entity_id;
+        if(!ecs_is_alive(ecs, entity_id)) continue;
+        if(ecs_get_signature(ecs, entity_id) & cvec->signature) {
+            memcpy(cvec->data+cvec->size_of_component*__ecs_sparse_index(cvec, __ecs_get_id(entity_id)), pending->data, cvec->size_of_component);
+            continue;
+        }
+        __link_entity_with_component(ecs, cvec, entity_id, vec_size(cvec->data));
+        memcpy(cvec->data+cvec->size_of_component*vec_size(cvec->data), pending->data, cvec->size_of_component);
+        vec_get_base(cvec->data)->size++;
+    }
+}
+
+// Additions to one entity, it moves straight to the archetype holding all of them
+static void __ecs_apply_entity_adds(ECS *ecs, EcsPendingCommand *begin, EcsPendingCommand *end) {
+    entity_t entity_id = begin->command.entity_id;
+    if(!ecs_is_alive(ecs, entity_id)) return;
+    uint32_t signature = ecs_get_signature(ecs, entity_id);
+    for(EcsPendingCommand *pending=begin;pending<end;pending++) {
+        signature |= ecs->component_vecs[pending->command.component_id].signature;
+    }
+    size_t row = __ecs_archetype_move(ecs, entity_id, signature);
+    EcsArchetype *archetype = &ecs->archetypes[ecs->entity_locations[__ecs_get_id(entity_id)].archetype];
+    for(EcsPendingCommand *pending=begin;pending<end;pending++) {
+        size_t component_id = pending->command.component_id;
+        memcpy(__ecs_archetype_component(ecs, archetype, component_id, row), pending->data, ecs->component_vecs[component_id].size_of_component);
+    }
+}
+
+// Applies what systems recorded in one sorted batch, see enum ecs_command_type for the order.
+// The keys are few, so it's a counting sort, stable so the recording order holds among equal keys.
+void ecs_flush_commands(ECS *ecs) {
+    bool by_component = ecs->storage == ECS_STORAGE_SPARSE_SET;
+    size_t offsets[ECS_COMMAND_KEYS+1] = {0};
+    size_t n_of_commands = 0;
+    for(EcsCommandBuffer *buffer=vec_begin(ecs->command_buffers);buffer<vec_end(ecs->command_buffers);buffer++) {
+        for(EcsCommand *command=vec_begin(buffer->commands);command<vec_end(buffer->commands);command++) {
+            offsets[__ecs_command_key(command, by_component)+1]++;
+        }
+        n_of_commands += vec_size(buffer->commands);
+    }
+    if(n_of_commands == 0) return;
+    for(size_t key=0;key<ECS_COMMAND_KEYS;key++) {
+        offsets[key+1] += offsets[key];
+    }
+    vec_grow(ecs->pending_commands, n_of_commands);
+    for(EcsCommandBuffer *buffer=vec_begin(ecs->command_buffers);buffer<vec_end(ecs->command_buffers);buffer++) {
+        for(EcsCommand *command=vec_begin(buffer->commands);command<vec_end(buffer->commands);command++) {
+            ecs->pending_commands[offsets[__ecs_command_key(command, by_component)]++] = (EcsPendingCommand){*command, buffer->data+command->data_offset};
+        }
+    }
+    vec_get_base(ecs->pending_commands)->size = n_of_commands;
+
+    EcsPendingCommand *end = vec_end(ecs->pending_commands);
+    for(EcsPendingCommand *pending=vec_begin(ecs->pending_commands);pending<end;) {
+        EcsCommand *command = &pending->command;
+        EcsPendingCommand *run_end = pending+1;
+        switch(command->type) {
+            case ECS_COMMAND_SPAWN:
+                __ecs_reserve_entity(ecs, __ecs_get_id(command->entity_id));
+                if(command->component_id) ecs_set_tag(ecs, command->entity_id, ecs_tag_id(ecs, (const char*)pending->data));
+                break;
+            case ECS_COMMAND_KILL:
+                __ecs_erase_entity(ecs, command->entity_id);
+                break;
+            case ECS_COMMAND_REMOVE_COMPONENT:
+                __ecs_remove_component(ecs, command->component_id, command->entity_id);
+                break;
+            case ECS_COMMAND_ADD_COMPONENT:
+                if(!by_component) {
+                    while(run_end<end && run_end->command.type == command->type && run_end->command.entity_id == command->entity_id) run_end++;
+                    __ecs_apply_entity_adds(ecs, pending, run_end);
+                }else {
+                    while(run_end<end && run_end->command.type == command->type && run_end->command.component_id == command->component_id) run_end++;
+                    __ecs_apply_component_adds(ecs, pending, run_end);
+                }
+                break;
+        }
+        pending = run_end;
+    }
+
+    vec_get_base(ecs->pending_commands)->size = 0;
+    for(EcsCommandBuffer *buffer=vec_begin(ecs->command_buffers);buffer<vec_end(ecs->command_buffers);buffer++) {
+        vec_get_base(buffer->commands)->size = 0;
+        vec_get_base(buffer->data)->size = 0;
+    }
+}
+
+void ecs_set_parallel_phase(ECS *ecs, enum system_type system_type, bool parallel) {
+    if(parallel) ecs->parallel_phases |= 1<<system_type;
+    else ecs->parallel_phases &= ~(1<<system_type);
+}
+
+void __ecs_set_system_access(ECS *ecs, enum system_type system_type, void *function, uint32_t read_mask, uint32_t write_mask) {
+    for(SystemCallback *func=vec_begin(ecs->systems[system_type]);func<vec_end(ecs->systems[system_type]);func++) {
+        if((void*)func->callback != function && (void*)func->batch_callback != function) continue;
+        func->read_mask = read_mask;
+        func->write_mask = write_mask;
+        func->declared_access = true;
+    }
+    ecs->schedule_dirty[system_type] = true;
+}
+
+void __ecs_set_system_resource_access(ECS *ecs, enum system_type system_type, void *function, uint32_t read_mask, uint32_t write_mask) {
+    for(SystemCallback *func=vec_begin(ecs->systems[system_type]);func<vec_end(ecs->systems[system_type]);func++) {
+        if((void*)func->callback != function && (void*)func->batch_callback != function) continue;
+        func->resource_read_mask = read_mask;
+        func->resource_write_mask = write_mask;
+    }
+    ecs->schedule_dirty[system_type] = true;
+}
+
+static bool __ecs_systems_conflict(ECS *ecs, SystemCallback *a, SystemCallback *b) {
+    if(!a->declared_access || !b->declared_access) return true;
+    if(a->resource_write_mask & (b->resource_read_mask | b->resource_write_mask)) return true;
+    if(b->resource_write_mask & a->resource_read_mask) return true;
+    // Queries read the signature's dense arrays and grouping batch systems reorder them
+    uint32_t a_reads = a->read_mask | a->entity_mask;
+    uint32_t b_reads = b->read_mask | b->entity_mask;
+    uint32_t a_writes = a->write_mask;
+    uint32_t b_writes = b->write_mask;
+    if(ecs->storage == ECS_STORAGE_SPARSE_SET) {
+        if(a->batch_callback) a_writes |= a->entity_mask;
+        if(b->batch_callback) b_writes |= b->entity_mask;
+    }
+    return (a_writes & (b_reads | b_writes)) || (b_writes & a_reads);
+}
+
+// Every system depends on the earlier systems of the phase it conflicts with, so the result matches serial order
+static void __ecs_build_schedule(ECS *ecs, enum system_type system_type) {
+    if(ecs->schedules[system_type]) {
+        for(EcsSystemNode *node=vec_begin(ecs->schedules[system_type]);node<vec_end(ecs->schedules[system_type]);node++) {
+            vec_free(node->dependents);
+        }
+        vec_free(ecs->schedules[system_type]);
+    }
+    size_t n_of_systems = vec_size(ecs->systems[system_type]);
+    EcsSystemNode *nodes = NULL;
+    vec_init(nodes, n_of_systems);
+    vec_get_base(nodes)->size = n_of_systems;
+    for(size_t ind=0;ind<n_of_systems;ind++) {
+        EcsSystemNode *node = &nodes[ind];
+        node->ecs = ecs;
+        node->system = &ecs->systems[system_type][ind];
+        node->dependents = NULL;
+        vec_init(node->dependents, 4);
+        node->n_of_dependencies = 0;
+        for(size_t before=0;before<ind;before++) {
+            if(!__ecs_systems_conflict(ecs, nodes[before].system, node->system)) continue;
+            vec_push(nodes[before].dependents, node);
+            node->n_of_dependencies++;
+        }
+    }
+    ecs->schedules[system_type] = nodes;
+    ecs->schedule_dirty[system_type] = false;
+}
+
+static void __ecs_system_job(void *data) {
+    EcsSystemNode *node = data;
+    __ecs_run_system(node->ecs, node->system);
+    for(EcsSystemNode **dependent=vec_begin(node->dependents);dependent<vec_end(node->dependents);dependent++) {
+        if(atomic_fetch_sub(&(*dependent)->remaining, 1) == 1) {
+            jobs_push(node->ecs->jobs, __ecs_system_job, *dependent);
+        }
+    }
+}
+
+void ecs_call_system(ECS *ecs, enum system_type system_type) {
+    uint64_t start = ecs->profiling ? __ecs_now_ns() : 0;
+    if(ecs->jobs == NULL || !(ecs->parallel_phases & (1<<system_type))) {
+        for(SystemCallback *func=vec_begin(ecs->systems[system_type]);func<vec_end(ecs->systems[system_type]);func++) {
+            __ecs_run_system(ecs, func);
+        }
+        ecs_flush_commands(ecs);
+        if(ecs->profiling) __ecs_profile_record(&ecs->phase_profiles[system_type], start, ecs->number_of_entities);
+        return;
+    }
+
+    if(ecs->schedule_dirty[system_type] || ecs->schedules[system_type] == NULL || vec_size(ecs->schedules[system_type]) != vec_size(ecs->systems[system_type])) {
+        __ecs_build_schedule(ecs, system_type);
+    }
+    EcsSystemNode *nodes = ecs->schedules[system_type];
+    for(EcsSystemNode *node=vec_begin(nodes);node<vec_end(nodes);node++) {
+        atomic_store(&node->remaining, node->n_of_dependencies);
+    }
+    for(EcsSystemNode *node=vec_begin(nodes);node<vec_end(nodes);node++) {
+        if(node->n_of_dependencies == 0) jobs_push(ecs->jobs, __ecs_system_job, node);
+    }
+    jobs_wait(ecs->jobs);
+    ecs_flush_commands(ecs);
+    if(ecs->profiling) __ecs_profile_record(&ecs->phase_profiles[system_type], start, ecs->number_of_entities);
+}
+
+// Profiling
+void ecs_set_profiling(ECS *ecs, bool profiling) {
+    ecs->profiling = profiling;
+}
+
+static EcsTiming __ecs_profile_summary(const EcsProfile *profile, const char *name) {
+    EcsTiming timing = {name, profile->count};
+    if(profile->count == 0) return timing;
+    uint64_t min = UINT64_MAX, max = 0, total = 0;
+    size_t entities = 0;
+    for(size_t ind=0;ind<profile->count;ind++) {
+        const EcsProfileSample *sample = &profile->samples[ind];
+        if(sample->duration < min) min = sample->duration;
+        if(sample->duration > max) max = sample->duration;
+        total += sample->duration;
+        entities += sample->entities;
+    }
+    size_t last = (profile->next+ECS_PROFILE_WINDOW-1) % ECS_PROFILE_WINDOW;
+    timing.last_ms = profile->samples[last].duration/1e6;
+    timing.min_ms = min/1e6;
+    timing.avg_ms = total/1e6/profile->count;
+    timing.max_ms = max/1e6;
+    timing.avg_entities = (double)entities/profile->count;
+    return timing;
+}
+
+EcsTiming ecs_system_timing(ECS *ecs, enum system_type system_type, size_t index) {
+    SystemCallback *func = &ecs->systems[system_type][index];
+    return __ecs_profile_summary(&func->profile, func->name);
+}
+
+EcsTiming ecs_phase_timing(ECS *ecs, enum system_type system_type) {
+    return __ecs_profile_summary(&ecs->phase_profiles[system_type], ecs_phase_name(system_type));
+}
+
+const char *ecs_phase_name(enum system_type system_type) {
+    static const char *names[NUM_OF_SYSTEM_TYPES] = {"ON_START", "ON_PREUPDATE", "ON_UPDATE", "ON_DRAW", "ON_END"};
+    return names[system_type];
+}
+
+static void __ecs_trace_events(FILE *file, ECS *ecs, const EcsProfile *profile, const char *name, const char *category, bool *first) {
+    for(size_t ind=0;ind<profile->count;ind++) {
+        const EcsProfileSample *sample = &profile->samples[ind];
+        fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%zu,\"args\":{\"entities\":%zu}}",
+            *first ? "" : ",", name, category, (sample->start-ecs->profile_epoch)/1e3, sample->duration/1e3, sample->thread, sample->entities);
+        *first = false;
+    }
+}
+
+bool ecs_dump_trace(ECS *ecs, const char *path) {
+    FILE *file = fopen(path, "w");
+    if(file == NULL) return false;
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for(size_t type=0;type<NUM_OF_SYSTEM_TYPES;type++) {
+        __ecs_trace_events(file, ecs, &ecs->phase_profiles[type], ecs_phase_name(type), "phase", &first);
+        for(SystemCallback *func=vec_begin(ecs->systems[type]);func<vec_end(ecs->systems[type]);func++) {
+            __ecs_trace_events(file, ecs, &func->profile, func->name, ecs_phase_name(type), &first);
         }
     }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
 }
 
 // Utility
 int component_compare(const void *a, const void *b, void *udata) {
     const struct component_kv *ca = a;
     const struct component_kv *cb = b;
+    if(ca->name == cb->name) return 0;
     return strcmp(ca->name, cb->name);
 }
 
@@ -147,6 +1189,18 @@ uint64_t component_hash(const void *item, uint64_t seed0, uint64_t seed1) {
     return hashmap_sip(component->name, strlen(component->name), seed0, seed1);
 }
 
+int tag_compare(const void *a, const void *b, void *udata) {
+    const struct tag_kv *ta = a;
+    const struct tag_kv *tb = b;
+    if(ta->name == tb->name) return 0;
+    return strcmp(ta->name, tb->name);
+}
+
+uint64_t tag_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct tag_kv *tag = item;
+    return hashmap_sip(tag->name, strlen(tag->name), seed0, seed1);
+}
+
 size_t sds_vector_find(sds *vec, sds value, size_t start) {
     for(size_t ind=start;ind<vec_size(vec);ind++) {
         if(vec[ind]==0) continue;
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include "../include/kxjobs.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+struct worker_args {
+    JobPool *pool;
+    size_t index;
+};
+
+static _Thread_local size_t worker_index = 0;
+static _Thread_local JobPool *worker_pool = NULL;
+
+size_t jobs_worker_index() {
+    return worker_index;
+}
+
+size_t jobs_pool_worker_index(JobPool *pool) {
+    return pool != NULL && worker_pool == pool ? worker_index : 0;
+}
+
+size_t jobs_hardware_threads() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+// Queues
+static void queue_init(JobQueue *queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->capacity = 64;
+    queue->ring = malloc(sizeof(Job)*queue->capacity);
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+static void queue_free(JobQueue *queue) {
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->ring);
+}
+
+static void queue_push(JobQueue *queue, Job job) {
+    pthread_mutex_lock(&queue->lock);
+    if(queue->tail - queue->head == queue->capacity) {
+        Job *ring = malloc(sizeof(Job)*queue->capacity*2);
+        for(size_t ind=queue->head;ind<queue->tail;ind++) {
+            ring[ind-queue->head] = queue->ring[ind%queue->capacity];
+        }
+        free(queue->ring);
+        queue->ring = ring;
+        queue->tail -= queue->head;
+        queue->head = 0;
+        queue->capacity *= 2;
+    }
+    queue->ring[queue->tail%queue->capacity] = job;
+    queue->tail++;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static bool queue_pop(JobQueue *queue, Job *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->tail != queue->head;
+    if(found) {
+        queue->tail--;
+        *job = queue->ring[queue->tail%queue->capacity];
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+static bool queue_steal(JobQueue *queue, Job *job) {
+    pthread_mutex_lock(&queue->lock);
+    bool found = queue->tail != queue->head;
+    if(found) {
+        *job = queue->ring[queue->head%queue->capacity];
+        queue->head++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+// Pool
+static bool jobs_take(JobPool *pool, size_t index, Job *job) {
+    if(queue_pop(&pool->queues[index], job)) return true;
+    for(size_t offset=1;offset<pool->n_of_queues;offset++) {
+        if(queue_steal(&pool->queues[(index+offset)%pool->n_of_queues], job)) return true;
+    }
+    return false;
+}
+
+static void jobs_run(JobPool *pool, Job job) {
+    atomic_fetch_sub(&pool->queued, 1);
+    job.func(job.data);
+    bool drained = job.counter && atomic_fetch_sub(job.counter, 1) == 1;
+    drained |= atomic_fetch_sub(&pool->pending, 1) == 1;
+    if(!drained) return;
+    // Under the lock, a waiter checks its counter and sleeps atomically
+    pthread_mutex_lock(&pool->sleep_lock);
+    if(pool->waiting) pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+static void *jobs_worker(void *data) {
+    struct worker_args args = *(struct worker_args*)data;
+    free(data);
+    JobPool *pool = args.pool;
+    worker_index = args.index;
+    worker_pool = pool;
+
+    while(1) {
+        Job job;
+        if(jobs_take(pool, args.index, &job)) {
+            jobs_run(pool, job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->sleep_lock);
+        while(atomic_load(&pool->queued)==0 && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+        }
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->sleep_lock);
+        if(stop) break;
+    }
+    return NULL;
+}
+
+JobPool *jobs_init(size_t n_of_workers) {
+    JobPool *pool = malloc(sizeof(JobPool));
+    pool->n_of_queues = n_of_workers+1;
+    pool->queues = malloc(sizeof(JobQueue)*pool->n_of_queues);
+    for(size_t ind=0;ind<pool->n_of_queues;ind++) {
+        queue_init(&pool->queues[ind]);
+    }
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->pending, 0);
+    pthread_mutex_init(&pool->sleep_lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->waiting = 0;
+    pool->stop = false;
+
+    pool->threads = malloc(sizeof(pthread_t)*(n_of_workers+1));
+    for(size_t ind=1;ind<=n_of_workers;ind++) {
+        struct worker_args *args = malloc(sizeof(struct worker_args));
+        *args = (struct worker_args){pool, ind};
+        pthread_create(&pool->threads[ind], NULL, jobs_worker, args);
+    }
+    return pool;
+}
+
+void jobs_free(JobPool *pool) {
+    pthread_mutex_lock(&pool->sleep_lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->sleep_lock);
+    for(size_t ind=1;ind<pool->n_of_queues;ind++) {
+        pthread_join(pool->threads[ind], NULL);
+    }
+    for(size_t ind=0;ind<pool->n_of_queues;ind++) {
+        queue_free(&pool->queues[ind]);
+    }
+    pthread_mutex_destroy(&pool->sleep_lock);
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool->queues);
+    free(pool);
+}
+
+void jobs_push(JobPool *pool, job_func_t func, void *data) {
+    jobs_push_counted(pool, func, data, NULL);
+}
+
+void jobs_push_counted(JobPool *pool, job_func_t func, void *data, atomic_size_t *counter) {
+    if(counter) atomic_fetch_add(counter, 1);
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    queue_push(&pool->queues[jobs_pool_worker_index(pool)], (Job){func, data, counter});
+    pthread_mutex_lock(&pool->sleep_lock);
+    pthread_cond_signal(&pool->wake);
+    // Waiters help with new jobs too, the job may be the one they wait on
+    if(pool->waiting) pthread_cond_broadcast(&pool->done);
+    pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+// Runs jobs until counter drains, sleeps on done while every queue is empty
+static void jobs_wait_until_zero(JobPool *pool, atomic_size_t *counter) {
+    while(atomic_load(counter) > 0) {
+        Job job;
+        if(jobs_take(pool, jobs_pool_worker_index(pool), &job)) {
+            jobs_run(pool, job);
+            continue;
+        }
+        pthread_mutex_lock(&pool->sleep_lock);
+        pool->waiting++;
+        while(atomic_load(counter) > 0 && atomic_load(&pool->queued) == 0) {
+            pthread_cond_wait(&pool->done, &pool->sleep_lock);
+        }
+        pool->waiting--;
+        pthread_mutex_unlock(&pool->sleep_lock);
+    }
+}
+
+void jobs_wait(JobPool *pool) {
+    jobs_wait_until_zero(pool, &pool->pending);
+}
+
+void jobs_wait_counter(JobPool *pool, atomic_size_t *counter) {
+    jobs_wait_until_zero(pool, counter);
+}